@@ -0,0 +1,442 @@
+#include "apu.h"
+
+// First register of each channel, NR10, NR20 (unused), NR30 and NR40 (unused)
+static const Byte CHANNEL_BASE[4] = { 0x10, 0x15, 0x1A, 0x1F };
+
+// Square wave duty patterns, 12.5%, 25%, 50% and 75%
+static const Byte DUTY_PATTERNS[4] = { 0x01, 0x81, 0x87, 0x7E };
+
+// Offsets into registers[]
+static const int
+	NR10 = 0x00,
+	NR32 = 0x0C,
+	NR43 = 0x12,
+	NR50 = 0x14,
+	NR51 = 0x15,
+	WAVE_RAM = 0x20;
+
+ApuWriteQueue::ApuWriteQueue(size_t capacity)
+	: emulated_cycle(0), dropped(0), epoch(0), write_index(0), read_index(0)
+{
+	// Round up to a power of two so indices wrap with a mask
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+
+	entries.resize(size);
+	mask = size - 1;
+}
+
+Apu::Apu(int _sample_rate)
+{
+	fill(registers, registers + sizeof(registers), 0);
+	set_sample_rate(_sample_rate);
+}
+
+void Apu::set_sample_rate(int rate)
+{
+	sample_rate = rate;
+	sample_phase = 0;
+
+	level_timer = CLOCK_RATE / SAMPLE_RATE;
+	level_sum[0] = level_sum[1] = 0;
+	level_count = 0;
+
+	// Time constant of the output capacitor, per sample
+	capacitor_charge = (float) pow(0.999958, (double) CLOCK_RATE / sample_rate);
+}
+
+void Apu::write(Byte reg, Byte value)
+{
+	// Wave RAM is kept while powered off
+	if (reg >= 0x30)
+	{
+		registers[reg - 0x10] = value;
+		return;
+	}
+
+	// NR52 - only the power bit can be written
+	if (reg == 0x26)
+	{
+		bool on = (value & 0x80) != 0;
+
+		if (!on && powered)
+			power_off();
+		else if (on && !powered)
+		{
+			powered = true;
+			sequencer_step = 0;
+		}
+		return;
+	}
+
+	if (!powered || reg < 0x10 || reg > 0x25)
+		return;
+
+	registers[reg - 0x10] = value;
+
+	if (reg >= 0x24)
+		return;
+
+	int id = (reg < 0x15) ? 0 : (reg < 0x1A) ? 1 : (reg < 0x1F) ? 2 : 3;
+	Channel &channel = channels[id];
+
+	switch (reg - CHANNEL_BASE[id])
+	{
+	// NR30 - wave DAC power, the other channels have sweep or nothing here
+	case 0:
+		if (id == 2)
+		{
+			channel.dac = (value & 0x80) != 0;
+			if (!channel.dac)
+				channel.enabled = false;
+		}
+		break;
+
+	// Length load
+	case 1:
+		channel.length = (id == 2) ? 256 - value : 64 - (value & 0x3F);
+		break;
+
+	// Envelope, turning the DAC off silences the channel
+	case 2:
+		if (id != 2)
+		{
+			channel.dac = (value & 0xF8) != 0;
+			if (!channel.dac)
+				channel.enabled = false;
+		}
+		break;
+
+	// Frequency low bits
+	case 3:
+		if (id != 3)
+			channel.frequency = (channel.frequency & 0x700) | value;
+		break;
+
+	// Frequency high bits, length enable and trigger
+	case 4:
+		if (id != 3)
+			channel.frequency = (channel.frequency & 0xFF) | ((value & 0x07) << 8);
+
+		channel.length_enabled = (value & 0x40) != 0;
+
+		if (value & 0x80)
+			trigger(id);
+		break;
+	}
+}
+
+void Apu::run(uint64_t cycles, vector<float> &samples)
+{
+	while (cycles > 0)
+	{
+		uint64_t to_sample = (CLOCK_RATE - sample_phase + sample_rate - 1) / sample_rate;
+		uint64_t step = min(cycles, min(to_sample, level_timer));
+
+		skip(step);
+		cycles -= step;
+		level_timer -= step;
+
+		// A box filter: at a lowered rate each sample is the average of the native rate
+		// levels it covers, so tones above the new Nyquist limit don't fold back down
+		if (level_timer == 0)
+		{
+			level_timer = CLOCK_RATE / SAMPLE_RATE;
+			add_level();
+		}
+
+		sample_phase += step * sample_rate;
+		if (sample_phase >= (uint64_t) CLOCK_RATE)
+		{
+			sample_phase -= CLOCK_RATE;
+			mix(samples);
+		}
+	}
+}
+
+void Apu::skip(uint64_t cycles)
+{
+	if (!powered)
+		return;
+
+	while (cycles > 0)
+	{
+		int step = (int) min<uint64_t>(cycles, sequencer_timer);
+
+		clock_channels(step);
+		cycles -= step;
+		sequencer_timer -= step;
+
+		if (sequencer_timer == 0)
+		{
+			sequencer_timer = 8192;
+			clock_sequencer();
+		}
+	}
+}
+
+// Cycles per waveform step
+int Apu::period(int id)
+{
+	switch (id)
+	{
+	case 0:
+	case 1:
+		return (2048 - channels[id].frequency) * 4;
+	case 2:
+		return (2048 - channels[id].frequency) * 2;
+	default:
+	{
+		Byte nr43 = registers[NR43];
+		int divisor = (nr43 & 0x07) ? (nr43 & 0x07) * 16 : 8;
+		return divisor << (nr43 >> 4);
+	}
+	}
+}
+
+void Apu::trigger(int id)
+{
+	Channel &channel = channels[id];
+
+	channel.enabled = channel.dac;
+	channel.timer = period(id);
+
+	if (channel.length == 0)
+		channel.length = (id == 2) ? 256 : 64;
+
+	if (id == 2)
+	{
+		channel.position = 0;
+		return;
+	}
+
+	Byte envelope = registers[CHANNEL_BASE[id] + 2 - 0x10];
+	channel.volume = envelope >> 4;
+	channel.envelope_up = (envelope & 0x08) != 0;
+	channel.envelope_period = envelope & 0x07;
+	channel.envelope_timer = channel.envelope_period ? channel.envelope_period : 8;
+
+	if (id == 3)
+		lfsr = 0x7FFF;
+
+	if (id == 0)
+	{
+		int sweep_period = (registers[NR10] >> 4) & 0x07;
+		int shift = registers[NR10] & 0x07;
+
+		sweep_shadow = channel.frequency;
+		sweep_timer = sweep_period ? sweep_period : 8;
+		sweep_enabled = sweep_period || shift;
+
+		if (shift && sweep_target() > 2047)
+			channel.enabled = false;
+	}
+}
+
+// Step every channel's waveform by a number of cycles
+void Apu::clock_channels(int cycles)
+{
+	for (int id = 0; id < 4; id++)
+	{
+		Channel &channel = channels[id];
+
+		channel.timer -= cycles;
+		if (channel.timer > 0)
+			continue;
+
+		int length = period(id);
+		int steps = -channel.timer / length + 1;
+		channel.timer += steps * length;
+
+		if (id < 2)
+			channel.position = (channel.position + steps) & 7;
+		else if (id == 2)
+			channel.position = (channel.position + steps) & 31;
+		else
+		{
+			bool width_7 = (registers[NR43] & 0x08) != 0;
+
+			// The register repeats every 32767 steps, or 127 in 7 bit mode once the
+			// upper bits have been shifted through, so long skips only run the remainder
+			if (!width_7)
+				steps %= 32767;
+			else if (steps > 15 + 127)
+				steps = 15 + (steps - 15) % 127;
+
+			for (int i = 0; i < steps; i++)
+			{
+				Byte_2 bit = (lfsr ^ (lfsr >> 1)) & 1;
+				lfsr = (lfsr >> 1) | (bit << 14);
+
+				if (width_7)
+					lfsr = (lfsr & ~0x40) | (bit << 6);
+			}
+		}
+	}
+}
+
+// 512 Hz: length at 256 Hz, sweep at 128 Hz, envelope at 64 Hz
+void Apu::clock_sequencer()
+{
+	if (sequencer_step % 2 == 0)
+		clock_length();
+
+	if (sequencer_step == 2 || sequencer_step == 6)
+		clock_sweep();
+
+	if (sequencer_step == 7)
+		clock_envelope();
+
+	sequencer_step = (sequencer_step + 1) & 7;
+}
+
+void Apu::clock_length()
+{
+	for (Channel &channel : channels)
+	{
+		if (channel.length_enabled && channel.length > 0 && --channel.length == 0)
+			channel.enabled = false;
+	}
+}
+
+void Apu::clock_envelope()
+{
+	for (int id : { 0, 1, 3 })
+	{
+		Channel &channel = channels[id];
+
+		if (channel.envelope_period == 0 || --channel.envelope_timer > 0)
+			continue;
+
+		channel.envelope_timer = channel.envelope_period;
+
+		if (channel.envelope_up && channel.volume < 15)
+			channel.volume++;
+		else if (!channel.envelope_up && channel.volume > 0)
+			channel.volume--;
+	}
+}
+
+void Apu::clock_sweep()
+{
+	if (--sweep_timer > 0)
+		return;
+
+	int sweep_period = (registers[NR10] >> 4) & 0x07;
+	sweep_timer = sweep_period ? sweep_period : 8;
+
+	if (!sweep_enabled || sweep_period == 0)
+		return;
+
+	int target = sweep_target();
+
+	if (target > 2047)
+	{
+		channels[0].enabled = false;
+		return;
+	}
+
+	if (registers[NR10] & 0x07)
+	{
+		sweep_shadow = target;
+		channels[0].frequency = target;
+
+		// Checked again with the new frequency
+		if (sweep_target() > 2047)
+			channels[0].enabled = false;
+	}
+}
+
+int Apu::sweep_target()
+{
+	int change = sweep_shadow >> (registers[NR10] & 0x07);
+	return (registers[NR10] & 0x08) ? sweep_shadow - change : sweep_shadow + change;
+}
+
+// Digital output of a channel, 0 - 15
+Byte Apu::output(int id)
+{
+	Channel &channel = channels[id];
+
+	if (!channel.enabled)
+		return 0;
+
+	switch (id)
+	{
+	case 0:
+	case 1:
+	{
+		Byte duty = registers[CHANNEL_BASE[id] + 1 - 0x10] >> 6;
+		return ((DUTY_PATTERNS[duty] >> (7 - channel.position)) & 1) ? channel.volume : 0;
+	}
+	case 2:
+	{
+		Byte pair = registers[WAVE_RAM + channel.position / 2];
+		Byte sample = (channel.position & 1) ? (pair & 0x0F) : (pair >> 4);
+		int volume_code = (registers[NR32] >> 5) & 0x03;
+		return volume_code ? sample >> (volume_code - 1) : 0;
+	}
+	default:
+		return (~lfsr & 1) ? channel.volume : 0;
+	}
+}
+
+void Apu::add_level()
+{
+	float sides[2] = { 0, 0 };
+	Byte panning = registers[NR51];
+
+	for (int id = 0; id < 4; id++)
+	{
+		if (!channels[id].dac)
+			continue;
+
+		// DAC maps 0 - 15 to 1 - -1
+		float value = 1 - output(id) / 7.5f;
+
+		if (panning & (0x10 << id))
+			sides[0] += value;
+		if (panning & (0x01 << id))
+			sides[1] += value;
+	}
+
+	Byte master = registers[NR50];
+	sides[0] *= (((master >> 4) & 0x07) + 1) / 8.0f;
+	sides[1] *= ((master & 0x07) + 1) / 8.0f;
+
+	level_sum[0] += sides[0];
+	level_sum[1] += sides[1];
+	level_count++;
+}
+
+void Apu::mix(vector<float> &samples)
+{
+	if (level_count == 0)
+		add_level();
+
+	for (int i = 0; i < 2; i++)
+	{
+		// Four channels at full volume add up to 4
+		float in = level_sum[i] / level_count / 4;
+		level_sum[i] = 0;
+		float out = in - capacitor[i];
+		capacitor[i] = in - out * capacitor_charge;
+
+		samples.push_back(out / 2);
+	}
+
+	level_count = 0;
+}
+
+// Clears every register except wave RAM and silences all channels
+void Apu::power_off()
+{
+	fill(registers, registers + 0x17, 0);
+
+	for (Channel &channel : channels)
+		channel = Channel();
+
+	sweep_enabled = false;
+	powered = false;
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <atomic>
+#include "types.h"
+
+// Sound register writes (0xFF10 - 0xFF3F) stamped with the cycle they happened on,
+// passed from the emulation thread to the audio thread. Single producer, single
+// consumer: Memory::write() pushes, AudioPlayer pops. Nothing waits, if the audio
+// thread falls a whole queue behind further writes are dropped and counted.
+class ApuWriteQueue
+{
+	public:
+
+		struct Entry
+		{
+			uint64_t cycle;
+			Byte reg;   // low byte of the register address
+			Byte value;
+			uint32_t epoch;
+		};
+
+		// Clock the writes are stamped with, set by Emulator::attach_audio()
+		const uint64_t* clock = nullptr;
+
+		// Newest cycle the emulation thread has finished, the audio thread can
+		// synthesize everything up to here
+		atomic<uint64_t> emulated_cycle;
+
+		atomic<uint64_t> dropped;
+
+		// Bumped by restart(), entries from an older epoch were stamped on a clock that
+		// no longer applies and are discarded by the consumer
+		atomic<uint32_t> epoch;
+
+		ApuWriteQueue(size_t capacity = 1 << 16);
+
+		void push(Address location, Byte value)
+		{
+			size_t tail = write_index.load(memory_order_relaxed);
+
+			if (tail - read_index.load(memory_order_acquire) >= entries.size())
+			{
+				dropped++;
+				return;
+			}
+
+			entries[tail & mask] = { *clock, (Byte) (location & 0xFF), value, epoch.load(memory_order_relaxed) };
+			write_index.store(tail + 1, memory_order_release);
+		}
+
+		// Called when the clock jumps, after a save state is loaded. The emulated cycle is
+		// published before the epoch so a consumer that sees the new epoch resumes from it
+		void restart()
+		{
+			emulated_cycle.store(*clock, memory_order_release);
+			epoch.store(epoch.load(memory_order_relaxed) + 1, memory_order_release);
+		}
+
+		// Called at the end of each frame or run_until()
+		void mark_time()
+		{
+			emulated_cycle.store(*clock, memory_order_release);
+		}
+
+		bool pop(Entry &entry)
+		{
+			size_t head = read_index.load(memory_order_relaxed);
+
+			if (head == write_index.load(memory_order_acquire))
+				return false;
+
+			entry = entries[head & mask];
+			read_index.store(head + 1, memory_order_release);
+			return true;
+		}
+
+		// The next write without removing it
+		bool peek(Entry &entry)
+		{
+			size_t head = read_index.load(memory_order_relaxed);
+
+			if (head == write_index.load(memory_order_acquire))
+				return false;
+
+			entry = entries[head & mask];
+			return true;
+		}
+
+	private:
+
+		vector<Entry> entries;
+		size_t mask;
+		atomic<size_t> write_index;
+		atomic<size_t> read_index;
+};
+
+// The four sound channels, frame sequencer and mixer. Only ever touched by the audio
+// thread, driven by the register writes from ApuWriteQueue in cycle order.
+class Apu
+{
+	public:
+
+		static const int CLOCK_RATE = 4194304;
+
+		// Native output rate, one sample every 32 cycles. Resampled to the host rate
+		static const int SAMPLE_RATE = 131072;
+
+		Apu(int _sample_rate = SAMPLE_RATE);
+
+		// Lowered while fast forwarding so fewer samples are mixed per emulated second
+		void set_sample_rate(int rate);
+		int get_sample_rate() { return sample_rate; }
+
+		// Register by the low byte of its address, 0x10 - 0x3F
+		void write(Byte reg, Byte value);
+
+		// Advance by a number of cycles, appending interleaved stereo samples at the sample rate
+		void run(uint64_t cycles, vector<float> &samples);
+
+		// Advance the channel state without producing samples, to catch up when behind
+		void skip(uint64_t cycles);
+
+	private:
+
+		struct Channel
+		{
+			bool enabled = false;
+			bool dac = false;
+
+			bool length_enabled = false;
+			int length = 0;
+
+			int frequency = 0;  // 11 bit NRx3/NRx4 value
+			int timer = 0;      // cycles left until the next waveform step
+			int position = 0;   // duty step or wave sample
+
+			int volume = 0;
+			int envelope_period = 0;
+			int envelope_timer = 0;
+			bool envelope_up = false;
+		};
+
+		int sample_rate;
+
+		Channel channels[4];
+		Byte registers[0x30];
+		bool powered = false;
+
+		// Channel 1 frequency sweep
+		bool sweep_enabled = false;
+		int sweep_timer = 0;
+		int sweep_shadow = 0;
+
+		// Channel 4 linear feedback shift register
+		Byte_2 lfsr = 0x7FFF;
+
+		// 512 Hz frame sequencer clocking length, sweep and envelope
+		int sequencer_timer = 8192;
+		int sequencer_step = 0;
+
+		// Time since the last sample in units of 1 / (CLOCK_RATE * sample_rate) seconds
+		uint64_t sample_phase = 0;
+
+		// Output levels at the native rate summed since the last sample, averaged into
+		// each sample when the rate is lowered
+		uint64_t level_timer = CLOCK_RATE / SAMPLE_RATE;
+		float level_sum[2] = { 0, 0 };
+		int level_count = 0;
+
+		// High pass filter state per side, removes the DAC offset
+		float capacitor[2] = { 0, 0 };
+		float capacitor_charge;
+
+		int period(int channel);
+		void trigger(int channel);
+		void clock_channels(int cycles);
+		void clock_sequencer();
+		void clock_length();
+		void clock_envelope();
+		void clock_sweep();
+		int sweep_target();
+		Byte output(int channel);
+		void add_level();
+		void mix(vector<float> &samples);
+		void power_off();
+};
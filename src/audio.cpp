@@ -0,0 +1,156 @@
+#include "audio.h"
+
+AudioPlayer::AudioPlayer(ApuWriteQueue &_queue, unsigned int _sample_rate)
+	: queue(_queue), resampler((double) Apu::SAMPLE_RATE / _sample_rate), sample_rate(_sample_rate)
+{
+	initialize(2, sample_rate);
+}
+
+AudioPlayer::~AudioPlayer()
+{
+	stop();
+}
+
+bool AudioPlayer::onGetData(Chunk &data)
+{
+	// A save state was loaded, carry on from its clock. Writes queued before it are
+	// dropped in advance()
+	uint32_t epoch = queue.epoch.load(memory_order_acquire);
+	uint64_t emulated = queue.emulated_cycle.load(memory_order_acquire);
+
+	if (epoch != apu_epoch)
+	{
+		apu_epoch = epoch;
+		apu_cycle = emulated;
+	}
+
+	// The load happened between the two loads above, wait for the next chunk
+	if (emulated < apu_cycle)
+		apu_cycle = emulated;
+
+	update_speed(emulated);
+
+	double skip_cycles = target_latency * skip_latency * max(speed, 1.0) * Apu::CLOCK_RATE;
+	if (emulated - apu_cycle > skip_cycles)
+		advance(emulated - (uint64_t) (target_latency * Apu::CLOCK_RATE), nullptr);
+
+	samples.resize(chunk_frames * 2);
+	size_t produced = 0;
+	int waits = 0;
+
+	while (true)
+	{
+		produced += resampler.read(&samples[produced * 2], chunk_frames - produced);
+
+		if (produced == chunk_frames)
+			break;
+
+		// Input for the rest of the chunk, plus the reach of the filter
+		double frames_needed = (chunk_frames - produced) * resampler.get_ratio() + Resampler::TAPS;
+		uint64_t cycles = (uint64_t) (frames_needed * Apu::CLOCK_RATE / apu.get_sample_rate()) + 1;
+
+		emulated = queue.emulated_cycle.load(memory_order_acquire);
+		uint64_t target = min(emulated, apu_cycle + cycles);
+
+		if (target > apu_cycle)
+		{
+			apu_samples.clear();
+			advance(target, &apu_samples);
+			resampler.write(apu_samples.data(), apu_samples.size() / 2);
+			continue;
+		}
+
+		// Emulation hasn't got this far yet, wait a little before giving up on the chunk
+		if (++waits > 20)
+			break;
+
+		sf::sleep(sf::milliseconds(1));
+	}
+
+	// Hold the last sample through an underrun rather than stopping the stream
+	int16_t left = produced ? samples[produced * 2 - 2] : 0;
+	int16_t right = produced ? samples[produced * 2 - 1] : 0;
+
+	for (size_t i = produced; i < chunk_frames; i++)
+	{
+		samples[i * 2] = left;
+		samples[i * 2 + 1] = right;
+	}
+
+	data.samples = samples.data();
+	data.sampleCount = samples.size();
+	return true;
+}
+
+// Pick the playback speed from the emulated time queued ahead of the Apu, then the Apu
+// rate and resampling ratio that go with it
+void AudioPlayer::update_speed(uint64_t emulated)
+{
+	double backlog = (double) (emulated - apu_cycle) / Apu::CLOCK_RATE;
+	double error = (backlog - target_latency) / target_latency;
+
+	// Close to the target only nudge the speed, far ahead means fast forward
+	double wanted = (error > 2)
+		? backlog / target_latency
+		: 1 + max_adjustment * max(-1.0, min(1.0, error));
+
+	speed += (wanted - speed) * 0.1;
+
+	int wanted_decimation = 1;
+	while (wanted_decimation * 2 <= speed && wanted_decimation < 64)
+		wanted_decimation *= 2;
+
+	if (wanted_decimation != decimation)
+	{
+		decimation = wanted_decimation;
+		apu.set_sample_rate(Apu::SAMPLE_RATE / decimation);
+	}
+
+	resampler.set_ratio(apu.get_sample_rate() * speed / sample_rate);
+}
+
+void AudioPlayer::onSeek(sf::Time)
+{
+}
+
+void AudioPlayer::advance(uint64_t cycle, vector<float>* output)
+{
+	ApuWriteQueue::Entry entry;
+
+	while (queue.peek(entry))
+	{
+		// Stamped before the last load, the clock it was on is gone
+		if ((int32_t) (entry.epoch - apu_epoch) < 0)
+		{
+			queue.pop(entry);
+			continue;
+		}
+
+		// Later than asked for, or from a load onGetData() hasn't caught up with yet
+		if (entry.cycle > cycle || entry.epoch != apu_epoch)
+			break;
+
+		if (entry.cycle > apu_cycle)
+		{
+			if (output)
+				apu.run(entry.cycle - apu_cycle, *output);
+			else
+				apu.skip(entry.cycle - apu_cycle);
+
+			apu_cycle = entry.cycle;
+		}
+
+		apu.write(entry.reg, entry.value);
+		queue.pop(entry);
+	}
+
+	if (cycle > apu_cycle)
+	{
+		if (output)
+			apu.run(cycle - apu_cycle, *output);
+		else
+			apu.skip(cycle - apu_cycle);
+	}
+
+	apu_cycle = cycle;
+}
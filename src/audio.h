@@ -0,0 +1,62 @@
+#pragma once
+
+#include <SFML\Audio.hpp>
+#include "apu.h"
+#include "resampler.h"
+
+// Plays the sound of a running emulator. SFML calls onGetData() on its own streaming
+// thread, which pops the register writes the emulation thread queued, synthesizes them
+// with an Apu and resamples to the host rate, so the emulation thread only ever pushes
+// writes.
+//
+// Playback is paced by the queue: the resampling ratio follows how far the emulated
+// clock is ahead, within max_adjustment of real time while emulation keeps pace, so
+// drift between the two clocks never builds up into gaps or lag. When fast forwarding
+// the speed follows the backlog all the way and the Apu drops to a power of two fraction
+// of its rate, so each emulated second costs fewer mixed samples.
+class AudioPlayer : public sf::SoundStream
+{
+	public:
+
+		AudioPlayer(ApuWriteQueue &_queue, unsigned int _sample_rate = 48000);
+		~AudioPlayer();
+
+		// Stereo samples per chunk handed to SFML
+		size_t chunk_frames = 1024;
+
+		// Emulated seconds kept queued ahead of playback
+		double target_latency = 0.05;
+
+		// Largest change of playback speed to correct drift, a pitch change of 0.5%
+		double max_adjustment = 0.005;
+
+		// Emulated sound this many times target_latency behind is skipped without playing
+		double skip_latency = 8;
+
+		// Emulated seconds played per second, above 1 while fast forwarding
+		double get_speed() { return speed; }
+
+	protected:
+
+		bool onGetData(Chunk &data) override;
+		void onSeek(sf::Time offset) override;
+
+	private:
+
+		ApuWriteQueue &queue;
+		Apu apu;
+		Resampler resampler;
+		unsigned int sample_rate;
+		double speed = 1;
+		int decimation = 1; // Apu rate divider
+
+		uint64_t apu_cycle = 0; // emulated cycle the Apu has reached
+		uint32_t apu_epoch = 0; // queue epoch apu_cycle belongs to
+		vector<float> apu_samples;
+		vector<int16_t> samples;
+
+		void update_speed(uint64_t emulated);
+
+		// Apply queued writes up to a cycle, with samples when output is set
+		void advance(uint64_t cycle, vector<float>* output);
+};
@@ -0,0 +1,91 @@
+#include "benchmark.h"
+
+#include <chrono>
+#include <iomanip>
+
+void Benchmark::run(string rom_location)
+{
+	Emulator emulator(true);
+	emulator.load_rom(rom_location, false);
+
+	PerfCounters perf;
+	if (counters && perf.open())
+		emulator.perf_counters = &perf;
+
+	int frames = (int) (seconds * 60);
+
+	auto start = chrono::steady_clock::now();
+
+	for (int i = 0; i < frames && emulator.stop_reason == StopReason::NONE; i++)
+		emulator.run_frame();
+
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << rom_location << ": " << emulator.frames_run << " frames in "
+		<< fixed << setprecision(2) << elapsed << "s, " << (emulator.frames_run / elapsed) << " FPS ("
+		<< (emulator.frames_run / elapsed / 60) << "x)" << endl;
+
+	if (!perf.available())
+	{
+		if (counters)
+			cout << "Performance counters unavailable" << endl;
+		return;
+	}
+
+	static const char* counter_names[] = { "cycles", "instructions", "branch misses", "L1D read misses", "LLC misses" };
+	static const char* subsystem_names[] = { "CPU", "timers", "PPU" };
+
+	// Per frame averages, and the worst frame by cycles
+	PerfCounters::Sample total;
+	size_t worst = 0;
+
+	for (size_t i = 0; i < perf.frames.size(); i++)
+	{
+		for (int counter = 0; counter < PerfCounters::COUNTER_COUNT; counter++)
+			total.values[counter] += perf.frames[i].values[counter];
+
+		if (perf.frames[i].values[PerfCounters::CYCLES] > perf.frames[worst].values[PerfCounters::CYCLES])
+			worst = i;
+	}
+
+	size_t frame_count = max((size_t) 1, perf.frames.size());
+
+	cout << "Per frame:" << endl;
+	for (int counter = 0; counter < PerfCounters::COUNTER_COUNT; counter++)
+	{
+		if (!perf.has_counter((PerfCounters::Counter) counter))
+			continue;
+
+		cout << "  " << setw(16) << left << counter_names[counter] << right << setw(14)
+			<< (total.values[counter] / frame_count) << endl;
+	}
+	cout << "  " << setw(16) << left << "IPC" << right << setw(14) << setprecision(2) << total.ipc() << endl;
+	cout << "  Slowest frame " << worst << ": " << perf.frames[worst].values[PerfCounters::CYCLES]
+		<< " cycles, IPC " << perf.frames[worst].ipc() << endl;
+
+	// Subsystem shares of the sampled steps
+	PerfCounters::Sample sampled;
+	for (int subsystem = 0; subsystem < PerfCounters::SUBSYSTEM_COUNT; subsystem++)
+	{
+		for (int counter = 0; counter < PerfCounters::COUNTER_COUNT; counter++)
+			sampled.values[counter] += perf.subsystems[subsystem].values[counter];
+	}
+
+	cout << "By subsystem (sampled every " << perf.sample_interval << " steps):" << endl;
+	for (int subsystem = 0; subsystem < PerfCounters::SUBSYSTEM_COUNT; subsystem++)
+	{
+		const PerfCounters::Sample &sample = perf.subsystems[subsystem];
+		cout << "  " << setw(8) << left << subsystem_names[subsystem] << right;
+
+		for (int counter = 0; counter < PerfCounters::COUNTER_COUNT; counter++)
+		{
+			if (!perf.has_counter((PerfCounters::Counter) counter) || sampled.values[counter] == 0)
+				continue;
+
+			cout << "  " << counter_names[counter] << " " << setprecision(1)
+				<< (100.0 * sample.values[counter] / sampled.values[counter]) << "%";
+		}
+
+		cout << "  IPC " << setprecision(2) << sample.ipc() << endl;
+	}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "emulator.h"
+#include "perf_counters.h"
+
+// Runs a ROM headless as fast as possible and reports emulated frames per second, along
+// with host performance counters per frame and their split between subsystems when the
+// platform provides them
+class Benchmark
+{
+	public:
+
+		double seconds = 60; // emulated
+
+		// Skip reading counters, to measure speed without their overhead
+		bool counters = true;
+
+		void run(string rom_location);
+};
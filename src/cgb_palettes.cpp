@@ -0,0 +1,120 @@
+#include "cgb_palettes.h"
+
+// RGBA for every RGB555 value, 5 bit channels scaled to the full 8 bits
+static const uint32_t* rgb555_to_rgba()
+{
+	static const vector<uint32_t> table = []()
+	{
+		vector<uint32_t> colors(0x8000);
+
+		for (uint32_t color = 0; color < 0x8000; color++)
+		{
+			uint32_t r = color & 0x1F, g = (color >> 5) & 0x1F, b = (color >> 10) & 0x1F;
+			r = (r << 3) | (r >> 2);
+			g = (g << 3) | (g >> 2);
+			b = (b << 3) | (b >> 2);
+
+			// Byte order R, G, B, A on little endian hosts, as sf::Image stores pixels
+			colors[color] = r | (g << 8) | (b << 16) | 0xFF000000;
+		}
+
+		return colors;
+	}();
+
+	return table.data();
+}
+
+// Luminance of every RGB555 value, from the same 8-bit channels as the RGBA table
+static const Byte* rgb555_to_luminance()
+{
+	static const vector<Byte> table = []()
+	{
+		vector<Byte> levels(0x8000);
+
+		for (uint32_t color = 0; color < 0x8000; color++)
+		{
+			uint32_t rgba = rgb555_to_rgba()[color];
+			uint32_t r = rgba & 0xFF, g = (rgba >> 8) & 0xFF, b = (rgba >> 16) & 0xFF;
+
+			levels[color] = (Byte) ((r * 77 + g * 150 + b * 29) >> 8);
+		}
+
+		return levels;
+	}();
+
+	return table.data();
+}
+
+CgbPalettes::CgbPalettes()
+{
+	reset();
+}
+
+// All palettes start out white
+void CgbPalettes::reset()
+{
+	for (int set = 0; set < 2; set++)
+	{
+		fill(data[set], data[set] + 64, 0xFF);
+		index[set] = 0;
+
+		for (int color = 0; color < 32; color++)
+			update_color(set, color);
+	}
+}
+
+void CgbPalettes::write_index(int set, Byte value)
+{
+	index[set] = value & 0xBF;
+}
+
+Byte CgbPalettes::read_index(int set)
+{
+	return index[set] | 0x40;
+}
+
+void CgbPalettes::write_data(int set, Byte value)
+{
+	Byte address = index[set] & 0x3F;
+
+	data[set][address] = value;
+	update_color(set, address / 2);
+
+	if (index[set] & 0x80)
+		index[set] = 0x80 | ((address + 1) & 0x3F);
+}
+
+Byte CgbPalettes::read_data(int set)
+{
+	return data[set][index[set] & 0x3F];
+}
+
+void CgbPalettes::save_state(ostream &file)
+{
+	file.write((char*)data, sizeof(data));
+	file.write((char*)index, sizeof(index));
+}
+
+void CgbPalettes::load_state(istream &file)
+{
+	file.read((char*)data, sizeof(data));
+	file.read((char*)index, sizeof(index));
+
+	for (int set = 0; set < 2; set++)
+	{
+		for (int color = 0; color < 32; color++)
+			update_color(set, color);
+	}
+}
+
+uint64_t CgbPalettes::hash(uint64_t seed)
+{
+	return hash_bytes(&data[0][0], sizeof(data), seed);
+}
+
+void CgbPalettes::update_color(int set, int color)
+{
+	Byte_2 rgb555 = (data[set][color * 2] | (data[set][color * 2 + 1] << 8)) & 0x7FFF;
+	colors[set][color / 4][color % 4] = rgb555_to_rgba()[rgb555];
+	luminance[set][color / 4][color % 4] = rgb555_to_luminance()[rgb555];
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "types.h"
+
+// Game Boy Color palette RAM behind BCPS/BCPD (0xFF68/0xFF69) and OCPS/OCPD
+// (0xFF6A/0xFF6B): 8 background and 8 sprite palettes of 4 RGB555 colours. Each data
+// write also converts its colour to RGBA and luminance through lookup tables, so the
+// display reads finished colours and never converts per pixel.
+class CgbPalettes
+{
+	public:
+
+		static const int
+			BACKGROUND = 0,
+			SPRITES    = 1;
+
+		// Four RGBA colours per palette, as the bytes R, G, B, A in memory
+		uint32_t colors[2][8][4];
+
+		// The same colours as 8-bit luminance
+		Byte luminance[2][8][4];
+
+		uint64_t hash(uint64_t seed);
+
+		CgbPalettes();
+		void reset();
+
+		// Index register, bit 7 increments the index after each data write
+		void write_index(int set, Byte value);
+		Byte read_index(int set);
+
+		void write_data(int set, Byte value);
+		Byte read_data(int set);
+
+		void save_state(ostream &file);
+		void load_state(istream &file);
+
+	private:
+
+		Byte data[2][64];
+		Byte index[2];
+
+		void update_color(int set, int color);
+};
@@ -0,0 +1,61 @@
+#include "compression.h"
+
+vector<Byte> compress(const Byte* data, size_t size)
+{
+	vector<Byte> output;
+	size_t i = 0;
+
+	while (i < size)
+	{
+		// Length of the run starting here
+		size_t run = 1;
+		while (i + run < size && run < 128 && data[i + run] == data[i])
+			run++;
+
+		if (run >= 3)
+		{
+			output.push_back((Byte) (257 - run));
+			output.push_back(data[i]);
+			i += run;
+			continue;
+		}
+
+		// Literals until the next run worth encoding
+		size_t start = i;
+		while (i < size && i - start < 128)
+		{
+			if (i + 2 < size && data[i] == data[i + 1] && data[i] == data[i + 2])
+				break;
+			i++;
+		}
+
+		output.push_back((Byte) (i - start - 1));
+		output.insert(output.end(), data + start, data + i);
+	}
+
+	return output;
+}
+
+vector<Byte> decompress(const Byte* data, size_t size)
+{
+	vector<Byte> output;
+	size_t i = 0;
+
+	while (i < size)
+	{
+		Byte control = data[i++];
+
+		if (control < 128)
+		{
+			size_t count = min((size_t) control + 1, size - i);
+			output.insert(output.end(), data + i, data + i + count);
+			i += count;
+		}
+		else if (i < size)
+		{
+			output.insert(output.end(), 257 - control, data[i++]);
+		}
+	}
+
+	return output;
+}
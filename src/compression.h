@@ -0,0 +1,10 @@
+#pragma once
+
+#include "types.h"
+
+// PackBits style run length encoding, save states are mostly runs of zeros in
+// unused RAM and VRAM so this shrinks them well at very little cost.
+// A control byte c < 128 is followed by c + 1 literal bytes, c >= 128 repeats the
+// next byte 257 - c times.
+vector<Byte> compress(const Byte* data, size_t size);
+vector<Byte> decompress(const Byte* data, size_t size);
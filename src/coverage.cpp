@@ -0,0 +1,141 @@
+#include "coverage.h"
+#include "parallel.h"
+
+#include <filesystem>
+#include <iomanip>
+#include <mutex>
+
+static string cb_name(Opcode code)
+{
+	static const char* registers[] = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
+	static const char* shifts[] = { "RLC", "RRC", "RL", "RR", "SLA", "SRA", "SWAP", "SRL" };
+	static const char* bit_ops[] = { "", "BIT", "RES", "SET" };
+
+	string target = registers[code & 0x07];
+
+	if (code < 0x40)
+		return string(shifts[code >> 3]) + " " + target;
+
+	return string(bit_ops[code >> 6]) + " " + to_string((code >> 3) & 0x07) + "," + target;
+}
+
+void OpcodeCoverage::merge(const OpcodeCoverage &other)
+{
+	for (int i = 0; i < 256; i++)
+	{
+		opcodes[i] += other.opcodes[i];
+		cb_opcodes[i] += other.cb_opcodes[i];
+		taken[i] += other.taken[i];
+		not_taken[i] += other.not_taken[i];
+	}
+}
+
+void OpcodeCoverage::report(ostream &out)
+{
+	uint64_t total = 0, cb_total = 0;
+	for (int i = 0; i < 256; i++)
+	{
+		total += opcodes[i];
+		cb_total += cb_opcodes[i];
+	}
+
+	if (total == 0)
+	{
+		out << "No instructions executed" << endl;
+		return;
+	}
+
+	auto by_count = [](const uint64_t* counts)
+	{
+		vector<int> order(256);
+		for (int i = 0; i < 256; i++)
+			order[i] = i;
+		stable_sort(order.begin(), order.end(), [&](int a, int b) { return counts[a] > counts[b]; });
+		return order;
+	};
+
+	out << fixed << setprecision(3);
+	out << total << " instructions, " << cb_total << " CB prefixed" << endl << endl;
+
+	out << "Opcodes:" << endl;
+	for (int code : by_count(opcodes))
+	{
+		if (opcodes[code] == 0)
+			break;
+		out << "  " << hex << uppercase << setw(2) << setfill('0') << code << dec << setfill(' ')
+			<< setw(16) << opcodes[code] << setw(9) << (100.0 * opcodes[code] / total) << "%" << endl;
+	}
+
+	out << endl << "CB opcodes:" << endl;
+	for (int code : by_count(cb_opcodes))
+	{
+		if (cb_opcodes[code] == 0)
+			break;
+		out << "  CB " << hex << uppercase << setw(2) << setfill('0') << code << dec << setfill(' ')
+			<< " " << setw(10) << left << cb_name(code) << right
+			<< setw(16) << cb_opcodes[code] << setw(9) << (100.0 * cb_opcodes[code] / max(cb_total, (uint64_t) 1)) << "%" << endl;
+	}
+
+	out << endl << "Conditional branches (taken / not taken):" << endl;
+	for (int code = 0; code < 256; code++)
+	{
+		if (!is_conditional(code) || opcodes[code] == 0)
+			continue;
+		out << "  " << hex << uppercase << setw(2) << setfill('0') << code << dec << setfill(' ')
+			<< setw(16) << taken[code] << setw(16) << not_taken[code]
+			<< setw(9) << (100.0 * taken[code] / opcodes[code]) << "% taken" << endl;
+	}
+
+	out << endl << "Never executed:";
+	for (int code = 0; code < 256; code++)
+	{
+		if (opcodes[code] == 0)
+			out << " " << hex << uppercase << setw(2) << setfill('0') << code;
+	}
+	out << dec << setfill(' ') << endl;
+}
+
+OpcodeCoverage CoverageRunner::run(string directory)
+{
+	vector<string> roms;
+
+	for (const auto &entry : filesystem::recursive_directory_iterator(directory))
+	{
+		string extension = entry.path().extension().string();
+		if (extension == ".gb" || extension == ".gbc")
+			roms.push_back(entry.path().string());
+	}
+
+	OpcodeCoverage merged;
+	mutex merged_lock;
+
+	// Each ROM is counted on its own and merged in once it's done
+	parallel_for(roms.size(), [&](size_t id)
+	{
+		OpcodeCoverage counts = run_rom(roms[id]);
+
+		lock_guard<mutex> lock(merged_lock);
+		merged.merge(counts);
+	});
+
+	cout << roms.size() << " ROMs" << endl;
+	return merged;
+}
+
+OpcodeCoverage CoverageRunner::run_rom(string location)
+{
+	OpcodeCoverage coverage;
+
+	if (filesystem::file_size(location) < 0x150)
+		return coverage;
+
+	Emulator emulator(true);
+	emulator.load_rom(location, false);
+	emulator.coverage = &coverage;
+
+	int frames = (int) (seconds * 60);
+	for (int i = 0; i < frames && emulator.stop_reason == StopReason::NONE; i++)
+		emulator.run_frame();
+
+	return coverage;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "emulator.h"
+
+// Executed instruction counts: every opcode, every CB prefixed opcode, and how often
+// each conditional jump, call and return was taken. Counts from many instances can be
+// merged into one report.
+class OpcodeCoverage
+{
+	public:
+
+		uint64_t opcodes[256] = { 0 };
+		uint64_t cb_opcodes[256] = { 0 };
+		uint64_t taken[256] = { 0 };     // conditional opcodes only
+		uint64_t not_taken[256] = { 0 };
+
+		// Called before the instruction executes, flags decide conditional branches
+		void count(Opcode code, Byte next, Byte flags)
+		{
+			opcodes[code]++;
+
+			if (code == 0xCB)
+			{
+				cb_opcodes[next]++;
+				return;
+			}
+
+			if (is_conditional(code))
+			{
+				// Condition in bits 3-4: NZ, Z, NC, C
+				int condition = (code >> 3) & 0x03;
+				bool set = (condition < 2) ? (flags & 0x80) != 0 : (flags & 0x10) != 0;
+
+				if (set == ((condition & 1) != 0))
+					taken[code]++;
+				else
+					not_taken[code]++;
+			}
+		}
+
+		void merge(const OpcodeCoverage &other);
+
+		// Opcodes sorted by count with their share of all instructions, the branch
+		// taken rates, and the opcodes that never ran
+		void report(ostream &out);
+
+		static bool is_conditional(Opcode code)
+		{
+			switch (code)
+			{
+				case 0x20: case 0x28: case 0x30: case 0x38: // JR cc
+				case 0xC2: case 0xCA: case 0xD2: case 0xDA: // JP cc
+				case 0xC4: case 0xCC: case 0xD4: case 0xDC: // CALL cc
+				case 0xC0: case 0xC8: case 0xD0: case 0xD8: // RET cc
+					return true;
+				default:
+					return false;
+			}
+		}
+};
+
+// Runs every ROM in a directory headless and in parallel, and merges their coverage
+class CoverageRunner
+{
+	public:
+
+		double seconds = 60; // emulated per ROM
+
+		OpcodeCoverage run(string directory);
+
+	private:
+
+		OpcodeCoverage run_rom(string location);
+};
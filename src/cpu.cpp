@@ -38,9 +38,25 @@ void CPU::reset()
 	reg_L = 0x4D;
 	reg_SP = 0xFFFE;
 	reg_PC = 0x100;
+
+	// The CGB boot ROM leaves A=$11 instead, which is how games tell they run on a CGB
+	if (memory && memory->cgb)
+	{
+		reg_A = 0x11;
+		reg_B = 0x00;
+		reg_C = 0x00;
+		reg_D = 0xFF;
+		reg_E = 0x56;
+		reg_F = 0x80;
+		reg_H = 0x00;
+		reg_L = 0x0D;
+	}
+
+	stop_reason = StopReason::NONE;
+	flush_block_cache();
 }
 
-void CPU::save_state(ofstream &file)
+void CPU::save_state(ostream &file)
 {
 	file.write((char*)&reg_A, sizeof(reg_A));
 	file.write((char*)&reg_B, sizeof(reg_B));
@@ -54,7 +70,7 @@ void CPU::save_state(ofstream &file)
 	file.write((char*)&reg_PC, sizeof(reg_PC));
 }
 
-void CPU::load_state(ifstream &file)
+void CPU::load_state(istream &file)
 {
 	file.read((char*)&reg_A, sizeof(reg_A));
 	file.read((char*)&reg_B, sizeof(reg_B));
@@ -820,8 +836,11 @@ void CPU::HALT()
 	// possibly skip next instruction here
 }
 
+// Only the CGB speed switch is emulated, low power mode is not and STOP otherwise
+// carries on like a NOP
 void CPU::STOP()
 {
+	memory->switch_speed();
 }
 
 void CPU::DI()
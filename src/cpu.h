@@ -3,6 +3,16 @@
 #include "types.h"
 #include "memory.h"
 
+// Why emulation was ended early, the first three can never recover on real hardware
+enum class StopReason
+{
+	NONE,
+	ILLEGAL_OPCODE, // one of the 11 unused opcodes, which lock up the CPU
+	HALT_FOREVER,   // HALT with no interrupts enabled in IE, e.g. DI; HALT
+	RST_38_SPIN,    // RST 38 executed at $0038, usually a jump into 0xFF filled memory
+	FROZEN          // same frame and no joypad polling for Emulator::freeze_seconds
+};
+
 // Gameboy CPU: 8-bit (Similar to the Z80 processor)
 class CPU
 {
@@ -23,18 +33,60 @@ class CPU
 		bool interrupt_master_enable = true;
 		bool halted = false;
 
-		void save_state(ofstream &file);
-		void load_state(ifstream &file);
+		// Set once the CPU reaches a state it can't leave
+		StopReason stop_reason = StopReason::NONE;
+
+		void save_state(ostream &file);
+		void load_state(istream &file);
+
+		// Flag updates proven dead by the block decoder are deferred
+		bool flag_elision = true;
+		Byte stale_flags = 0; // flags in reg_F left stale by deferred updates
 
 		void init(Memory* _memory);
 		void reset();
+		void step();
 		void parse_opcode(Opcode code);
+		void flush_block_cache();
+		void resolve_flags();
 		void debug();
 
 	private:
 
 		Memory* memory;
 
+		// Per-address decode info for cartridge ROM ($0000 - $7FFF)
+		struct DecodedInstruction
+		{
+			bool valid = false;
+			bool flags_dead = false;
+			Byte flag_writes = 0;
+			Byte bank = 0;
+		};
+
+		vector<DecodedInstruction> block_cache;
+
+		// Operands of a deferred flag update, enough to recompute the flags in mask.
+		// Masks never overlap, so one record per flag is the most there can be
+		struct LazyFlags
+		{
+			Opcode code;
+			Byte_2 target;
+			Byte_2 value;
+			Byte carry;
+			Byte mask;
+		};
+
+		LazyFlags lazy_flags[4];
+		int lazy_count = 0;
+
+		void decode_block(Address start, Byte bank);
+		void parse_flagless_opcode(Opcode code, Byte writes);
+		void defer_flags(Opcode code, Byte_2 target, Byte_2 value, Byte writes);
+		void overwrite_flags(Byte writes);
+		Byte* register_operand(int index);
+		Byte carry_bit();
+
 		const int
 			FLAG_ZERO       = 0b10000000,
 			FLAG_SUB        = 0b01000000,
@@ -0,0 +1,456 @@
+#include "cpu.h"
+
+/*
+	Block Decoder
+
+	Cartridge ROM is split into basic blocks (straight-line runs of instructions
+	ending at a jump, call, return or anything else that can leave the block).
+	A backwards liveness pass over each block finds ALU instructions whose flag
+	results are overwritten before anything reads them, those are executed by
+	parse_flagless_opcode() instead of the full handlers in opcodes.cpp.
+
+	All flags are treated as live at the end of every block, so reg_F is always
+	exact once control leaves a block.
+
+	An interrupt can be taken between any two instructions and its handler may push
+	AF, so a skipped update keeps its operands in lazy_flags. resolve_flags() replays
+	them before anything outside the block looks at reg_F: interrupt dispatch, save
+	states and state hashes.
+*/
+
+static const int MAX_BLOCK_LENGTH = 32;
+
+static const Byte ALL_FLAGS = 0xF0;
+
+static const Byte
+	F_Z = 0x80,
+	F_N = 0x40,
+	F_H = 0x20,
+	F_C = 0x10;
+
+// Instruction sizes in bytes, CB prefixed instructions are always 2
+static const Byte INSTRUCTION_LENGTHS[0x100] =
+{
+	1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1, // 0x
+	1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 1x
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 2x
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 3x
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 4x
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 5x
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 6x
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 7x
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 8x
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 9x
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // Ax
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // Bx
+	1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1, // Cx
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, // Dx
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // Ex
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1  // Fx
+};
+
+// Instructions that transfer control, change interrupt state or are undefined
+static bool ends_block(Opcode code)
+{
+	switch (code)
+	{
+		case 0xC3: case 0xC2: case 0xCA: case 0xD2: case 0xDA: // JP
+		case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+		case 0xE9:                                             // JP (HL)
+		case 0xCD: case 0xC4: case 0xCC: case 0xD4: case 0xDC: // CALL
+		case 0xC9: case 0xC0: case 0xC8: case 0xD0: case 0xD8: // RET
+		case 0xD9:                                             // RETI
+		case 0xC7: case 0xCF: case 0xD7: case 0xDF:            // RST
+		case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+		case 0x76: case 0x10:                                  // HALT, STOP
+		case 0xF3: case 0xFB:                                  // DI, EI
+		case 0xD3: case 0xDB: case 0xDD: case 0xE3:            // undefined
+		case 0xE4: case 0xEB: case 0xEC: case 0xED:
+		case 0xF4: case 0xFC: case 0xFD:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Instructions that may write to memory. Inside a switchable ROM bank any of these
+// could be a bank switch, which would change the rest of the block underneath us.
+static bool writes_memory(Opcode code, Opcode cb_code)
+{
+	switch (code)
+	{
+		case 0x02: case 0x12: case 0x22: case 0x32:
+		case 0x34: case 0x35: case 0x36: case 0x08:
+		case 0x70: case 0x71: case 0x72: case 0x73:
+		case 0x74: case 0x75: case 0x77:
+		case 0xE0: case 0xE2: case 0xEA:
+			return true;
+		case 0xCB:
+			// (HL) operand, everything but BIT writes the result back
+			return ((cb_code & 0x07) == 0x06) && !between(cb_code, 0x40, 0x7F);
+		default:
+			return false;
+	}
+}
+
+// Flags read and written by an instruction, matching the handlers in cpu.cpp.
+// Flags that are only written conditionally are not reported as written.
+static void flag_usage(Opcode code, Opcode cb_code, Byte& reads, Byte& writes)
+{
+	reads = 0;
+	writes = 0;
+
+	if (code == 0xCB)
+	{
+		if (cb_code < 0x40)
+		{
+			writes = ALL_FLAGS;
+			if (between(cb_code, 0x10, 0x1F)) // RL, RR
+				reads = F_C;
+		}
+		else if (cb_code < 0x80) // BIT
+		{
+			writes = F_Z | F_N | F_H;
+		}
+		return;
+	}
+
+	if (between(code, 0x80, 0xBF))
+	{
+		writes = ALL_FLAGS;
+		if (between(code, 0x88, 0x8F) || between(code, 0x98, 0x9F)) // ADC, SBC
+			reads = F_C;
+		return;
+	}
+
+	switch (code)
+	{
+		case 0xC6: case 0xD6: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+		case 0xE8: case 0xF8: case 0x07: case 0x0F: case 0xF1:
+			writes = ALL_FLAGS;
+			break;
+		case 0xCE: case 0xDE: case 0x17: case 0x1F:
+			writes = ALL_FLAGS;
+			reads = F_C;
+			break;
+		case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x34: case 0x3C:
+		case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x35: case 0x3D:
+			writes = F_Z | F_N | F_H;
+			break;
+		case 0x09: case 0x19: case 0x29: case 0x39:
+			writes = F_N | F_H | F_C;
+			break;
+		case 0x27: // DAA
+			writes = F_Z | F_H;
+			reads = F_N | F_H | F_C;
+			break;
+		case 0x2F: // CPL
+			writes = F_N | F_H;
+			break;
+		case 0x37: // SCF
+			writes = F_N | F_H | F_C;
+			break;
+		case 0x3F: // CCF
+			writes = F_N | F_H | F_C;
+			reads = F_C;
+			break;
+		case 0xF5: // PUSH AF
+			reads = ALL_FLAGS;
+			break;
+		case 0xC2: case 0xCA: case 0xC4: case 0xCC: case 0xC0: case 0xC8: case 0x20: case 0x28:
+			reads = F_Z;
+			break;
+		case 0xD2: case 0xDA: case 0xD4: case 0xDC: case 0xD0: case 0xD8: case 0x30: case 0x38:
+			reads = F_C;
+			break;
+	}
+}
+
+// Instructions with a flag-free variant in parse_flagless_opcode()
+static bool has_flagless_variant(Opcode code)
+{
+	if (between(code, 0x80, 0xBF))
+		return true;
+
+	switch (code)
+	{
+		case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+		case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x34: case 0x3C:
+		case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x35: case 0x3D:
+		case 0x09: case 0x19: case 0x29: case 0x39:
+			return true;
+		default:
+			return false;
+	}
+}
+
+void CPU::flush_block_cache()
+{
+	block_cache.assign(0x8000, DecodedInstruction());
+	lazy_count = 0;
+	stale_flags = 0;
+}
+
+// Execute the instruction at PC, using the flag-free handler when the block decoder
+// proved its flag results are never read inside the block
+void CPU::step()
+{
+	Opcode code = memory->fetch(reg_PC);
+
+	// Code outside of cartridge ROM may be modified at any time, don't cache it
+	if (!flag_elision || reg_PC >= 0x8000)
+	{
+		if (stale_flags != 0)
+		{
+			Byte reads, writes;
+			flag_usage(code, memory->fetch(reg_PC + 1), reads, writes);
+			overwrite_flags(writes);
+		}
+
+		parse_opcode(code);
+		return;
+	}
+
+	Byte bank = (reg_PC >= 0x4000) ? memory->get_rom_bank() : 0;
+	DecodedInstruction& decoded = block_cache[reg_PC];
+
+	if (!decoded.valid || decoded.bank != bank)
+		decode_block(reg_PC, bank);
+
+	if (decoded.flags_dead)
+	{
+		parse_flagless_opcode(code, decoded.flag_writes);
+	}
+	else
+	{
+		if (stale_flags & decoded.flag_writes)
+			overwrite_flags(decoded.flag_writes);
+		parse_opcode(code);
+	}
+}
+
+// Deferred flags that an exact update has written over no longer need replaying
+void CPU::overwrite_flags(Byte writes)
+{
+	int kept = 0;
+
+	for (int i = 0; i < lazy_count; i++)
+	{
+		lazy_flags[i].mask &= ~writes;
+		if (lazy_flags[i].mask != 0)
+			lazy_flags[kept++] = lazy_flags[i];
+	}
+
+	lazy_count = kept;
+	stale_flags &= ~writes;
+}
+
+void CPU::defer_flags(Opcode code, Byte_2 target, Byte_2 value, Byte writes)
+{
+	overwrite_flags(writes);
+
+	LazyFlags& lazy = lazy_flags[lazy_count++];
+	lazy.code = code;
+	lazy.target = target;
+	lazy.value = value;
+	lazy.carry = carry_bit();
+	lazy.mask = writes;
+
+	stale_flags |= writes;
+}
+
+// Recompute every deferred flag with the full handlers, oldest update first
+void CPU::resolve_flags()
+{
+	for (int i = 0; i < lazy_count; i++)
+	{
+		const LazyFlags& lazy = lazy_flags[i];
+		Byte kept = reg_F & ~lazy.mask;
+		Byte target = (Byte) lazy.target;
+		Byte value = (Byte) lazy.value;
+
+		reg_F = lazy.carry ? FLAG_CARRY : 0;
+
+		if ((lazy.code & 0xC7) == 0x04)
+			INC(target);
+		else if ((lazy.code & 0xC7) == 0x05)
+			DEC(target);
+		else if ((lazy.code & 0xCF) == 0x09)
+			ADD16(lazy.target, lazy.value);
+		else
+		{
+			switch ((lazy.code >> 3) & 0x07)
+			{
+				case 0: ADD(target, value); break;
+				case 1: ADC(target, value); break;
+				case 2: SUB(target, value); break;
+				case 3: SBC(target, value); break;
+				case 4: AND(target, value); break;
+				case 5: XOR(target, value); break;
+				case 6: OR(target, value); break;
+				case 7: CP(target, value); break;
+			}
+		}
+
+		reg_F = kept | (reg_F & lazy.mask);
+	}
+
+	lazy_count = 0;
+	stale_flags = 0;
+}
+
+void CPU::decode_block(Address start, Byte bank)
+{
+	Address block[MAX_BLOCK_LENGTH];
+	Byte reads[MAX_BLOCK_LENGTH];
+	Byte writes[MAX_BLOCK_LENGTH];
+	int length = 0;
+
+	// Region the block must stay inside, a bank switch can't move code under it
+	Address region_end = (start < 0x4000) ? 0x4000 : 0x8000;
+	Address pc = start;
+
+	// 1. Walk forward until something ends the block
+	while (length < MAX_BLOCK_LENGTH)
+	{
+		Opcode code = memory->fetch(pc);
+		Opcode cb_code = memory->fetch(pc + 1);
+
+		block[length] = pc;
+		flag_usage(code, cb_code, reads[length], writes[length]);
+		length++;
+
+		int next = pc + INSTRUCTION_LENGTHS[code];
+
+		if (ends_block(code) || next >= region_end)
+			break;
+		if (bank != 0 && writes_memory(code, cb_code))
+			break;
+
+		pc = (Address) next;
+	}
+
+	// 2. Walk backwards tracking which flags are still going to be read
+	Byte live = ALL_FLAGS;
+
+	for (int i = length - 1; i >= 0; i--)
+	{
+		DecodedInstruction& decoded = block_cache[block[i]];
+		Opcode code = memory->fetch(block[i]);
+
+		decoded.valid = true;
+		decoded.bank = bank;
+		decoded.flag_writes = writes[i];
+		decoded.flags_dead = has_flagless_variant(code) && (writes[i] & live) == 0;
+
+		live = (live & ~writes[i]) | reads[i];
+	}
+}
+
+Byte CPU::carry_bit()
+{
+	return (reg_F & FLAG_CARRY) ? 1 : 0;
+}
+
+// Register operand encoded in the low or middle three bits of an opcode, 6 is (HL)
+Byte* CPU::register_operand(int index)
+{
+	switch (index)
+	{
+		case 0: return &reg_B;
+		case 1: return &reg_C;
+		case 2: return &reg_D;
+		case 3: return &reg_E;
+		case 4: return &reg_H;
+		case 5: return &reg_L;
+		case 7: return &reg_A;
+		default: return nullptr;
+	}
+}
+
+// Same instructions as parse_opcode() but the flag update is deferred to lazy_flags
+void CPU::parse_flagless_opcode(Opcode code, Byte writes)
+{
+	Address hl = Pair(reg_H, reg_L).address();
+
+	// ADD, ADC, SUB, SBC, AND, XOR, OR and CP, on a register, (HL) or an immediate
+	if (between(code, 0x80, 0xBF) || (code & 0xC7) == 0xC6)
+	{
+		Byte value;
+
+		if (code >= 0xC0)
+		{
+			value = memory->fetch(reg_PC + 1);
+			op(2, 2);
+		}
+		else if ((code & 0x07) == 0x06)
+		{
+			value = memory->read(hl);
+			op(1, 2);
+		}
+		else
+		{
+			value = *register_operand(code & 0x07);
+			op(1, 1);
+		}
+
+		defer_flags(code, reg_A, value, writes);
+
+		switch ((code >> 3) & 0x07)
+		{
+			case 0: reg_A += value; break;
+			case 1: reg_A += value + carry_bit(); break;
+			case 2: reg_A -= value; break;
+			case 3: reg_A -= value + carry_bit(); break;
+			case 4: reg_A &= value; break;
+			case 5: reg_A ^= value; break;
+			case 6: reg_A |= value; break;
+			case 7: break; // CP only produces flags
+		}
+		return;
+	}
+
+	// INC and DEC, on a register or (HL)
+	if ((code & 0xC6) == 0x04)
+	{
+		Byte step = (code & 0x01) ? 0xFF : 0x01;
+		int index = (code >> 3) & 0x07;
+
+		if (index == 6)
+		{
+			Byte value = memory->read(hl);
+			defer_flags(code, value, 0, writes);
+			memory->write(hl, value + step);
+			op(1, 3);
+		}
+		else
+		{
+			Byte& target = *register_operand(index);
+			defer_flags(code, target, 0, writes);
+			target += step;
+			op(1, 1);
+		}
+		return;
+	}
+
+	// ADD HL, rr
+	if ((code & 0xCF) == 0x09)
+	{
+		Byte_2 value;
+
+		switch (code >> 4)
+		{
+			case 0: value = Pair(reg_B, reg_C).get(); break;
+			case 1: value = Pair(reg_D, reg_E).get(); break;
+			case 2: value = hl; break;
+			default: value = reg_SP; break;
+		}
+
+		defer_flags(code, hl, value, writes);
+		Pair(reg_H, reg_L).set(hl + value);
+		op(1, 2);
+		return;
+	}
+
+	parse_opcode(code);
+}
@@ -1,18 +1,25 @@
 #include "display.h"
 
-void Display::init(Memory* _memory)
+#include <cstring>
+
+void Display::init(Memory* _memory, bool _headless)
 {
 	memory = _memory;
+	headless = _headless;
 
 	int scale = 5;
-	
-	window.create(sf::VideoMode(width, height), "Gameboy Emulator");
-	window.setSize(sf::Vector2u(width * scale, height * scale));
-	window.setKeyRepeatEnabled(false);
+
+	if (!headless)
+	{
+		window.create(sf::VideoMode(width, height), "Gameboy Emulator");
+		window.setSize(sf::Vector2u(width * scale, height * scale));
+		window.setKeyRepeatEnabled(false);
+	}
 
 	bg_array.create(160, 144, sf::Color(255, 0, 255));
-	window_array.create(160, 144,  sf::Color(0, 0, 0, 0));
-	sprites_array.create(160, 144, sf::Color(0, 0, 0, 0)); // transparent
+	color_frame.assign(160 * 144, 0xFFFFFFFF);
+	frame_pixels.assign(160 * 144, 0);
+	tile_cache.assign(2 * 384 * 4 * 64, 0);
 	
 	shades_of_gray[0x0] = sf::Color(255, 255, 255); // 0x0 - White
 	shades_of_gray[0x1] = sf::Color(198, 198, 198); // 0x1 - Light Gray
@@ -28,6 +35,13 @@ void Display::init(Memory* _memory)
 	shades_of_gray[0x1] = sf::Color(115, 160, 103); // 0x1 - Light Gray
 	shades_of_gray[0x2] = sf::Color(53, 98, 55); // 0x2 - Drak Gray
 	shades_of_gray[0x3] = sf::Color(15, 56, 14);       // 0x3 - Black*/
+
+	for (int shade = 0; shade < 4; shade++)
+	{
+		sf::Color color = shades_of_gray[shade];
+		Byte rgba[4] = { color.r, color.g, color.b, 255 };
+		memcpy(&shade_colors[shade], rgba, 4);
+	}
 }
 
 void Display::render()
@@ -35,361 +49,443 @@ void Display::render()
 	if (!is_lcd_enabled())
 		return;
 
-	window.clear(sf::Color::Transparent);
-
-	// clear existig sprite and window data
-	sprites_array.create(160, 144, sf::Color::Transparent);
+	// Frames are finished scanline by scanline, sprites included
+	if (draw_images)
+		bg_array.create(160, 144, (const sf::Uint8*) color_frame.data());
 
-	bool do_sprites = memory->LCDC.is_bit_set(BIT_1);
+	if (headless)
+		return;
 
-	if (do_sprites)
-		render_sprites();
+	window.clear(sf::Color::Transparent);
 
 	sf::Texture bg_texture;
-	sf::Texture window_texture;
-	sf::Texture sprites_texture;
-
-	window_texture.loadFromImage(window_array);
 	bg_texture.loadFromImage(bg_array);
-	sprites_texture.loadFromImage(sprites_array);
-
-	window_sprite.setTexture(window_texture);
 	bg_sprite.setTexture(bg_texture);
-	sprites_sprite.setTexture(sprites_texture);
-	
-	window.draw(bg_sprite);
-	window.draw(window_sprite);
-	window.draw(sprites_sprite);
 
+	window.draw(bg_sprite);
 	window.display();
 }
 
-void Display::clear_window()
+void Display::update_scanline(Byte current_scanline)
 {
-	window_array.create(160, 144, sf::Color::Transparent);
+	scanlines_rendered++;
+
+	if (tile_observation)
+		update_tile_observation(current_scanline);
+
+	if (current_scanline >= 144)
+		return;
+
+	bool observing = observation != Observation::NONE && observation_buffer;
+
+	// Nothing reads the composed scanline
+	if (!draw_images && !observing && !hash_frames)
+		return;
+
+	compose_scanline(current_scanline);
+
+	if (observing)
+		update_observation_scanline(current_scanline);
 }
 
-void Display::update_scanline(Byte current_scanline)
+int Display::observation_size(Observation mode)
 {
-	scanlines_rendered++;
+	switch (mode)
+	{
+		case Observation::SHADES:
+		case Observation::GRAY:       return 160 * 144;
+		case Observation::GRAY_80x72: return 80 * 72;
+		case Observation::GRAY_84x84: return 84 * 84;
+		default:                      return 0;
+	}
+}
 
-	bool do_background = memory->LCDC.is_bit_set(BIT_0);
-	bool do_window     = memory->LCDC.is_bit_set(BIT_5);
+// Taken from the composed scanlines, so it's the same whether images are drawn or not.
+// Only kept up to date while something has the scanlines composed, see hash_frames
+uint64_t Display::frame_hash()
+{
+	uint64_t hash = hash_bytes(frame_pixels.data(), frame_pixels.size());
 
-	if (do_background)
-		update_bg_scanline(current_scanline);
+	// CGB pixels are palette entries, the colours behind them are part of the frame
+	if (memory->cgb)
+		hash = memory->palettes.hash(hash);
 
-	if (do_window)
-		update_window_scanline(current_scanline);
+	return hash;
 }
 
-void Display::update_bg_scanline(Byte current_scanline)
+// Writes the composed scanline out in the observation format without going through the
+// RGBA images. Colour scanlines are taken as their luminance, looked up from the palette
+// entries, and in four shades of it
+void Display::update_observation_scanline(Byte current_scanline)
 {
-	bool bg_code_area = memory->LCDC.is_bit_set(BIT_3);
+	if (current_scanline >= 144)
+		return;
 
-	if (debug_enabled)
+	int y = current_scanline;
+	const Byte* pixels = &frame_pixels[y * 160];
+	Byte shades[160];
+	Byte gray[160];
+
+	if (memory->cgb)
 	{
-		bg_code_area = force_bg_map;
+		const Byte* luminance = &memory->palettes.luminance[0][0][0];
+
+		for (int x = 0; x < 160; x++)
+		{
+			gray[x] = luminance[pixels[x]];
+			shades[x] = 3 - gray[x] / 64;
+		}
+	}
+	else
+	{
+		for (int x = 0; x < 160; x++)
+		{
+			shades[x] = pixels[x];
+			gray[x] = shades_of_gray[pixels[x]].r;
+		}
 	}
 
-	Address tile_map_location = (bg_code_area) ? 0x9C00 : 0x9800;
-	Byte scroll_x = memory->SCX.get();
-	Byte scroll_y = memory->SCY.get();
+	if (observation == Observation::SHADES)
+	{
+		copy(shades, shades + 160, observation_buffer + y * 160);
+		return;
+	}
 
-	//cout << hex << (int)scroll_x << " y: " << (int)scroll_y << endl;
+	if (observation == Observation::GRAY)
+	{
+		copy(gray, gray + 160, observation_buffer + y * 160);
+		return;
+	}
 
-	Byte palette = memory->BGP.get();
+	// Downsampled modes, each output pixel averages the screen pixels that map onto it
+	int out_width  = (observation == Observation::GRAY_80x72) ? 80 : 84;
+	int out_height = (observation == Observation::GRAY_80x72) ? 72 : 84;
 
-	// For each pixel in the 160x1 scanline:
-	// 1. Calculate where the pixel resides in the overall 256x256 background map
-	// 2. Get the tile ID where that pixel is located
-	// 3. Get the pixel color based on that coordinate relative to the 8x8 tile grid
-	// 4. Plot pixel in 160x144 display view
+	int row = y * out_height / 144;
 
-	int y = current_scanline;
+	// First scanline of an output row
+	if (y == 0 || (y - 1) * out_height / 144 != row)
+	{
+		fill(observation_sums, observation_sums + out_width, 0);
+		fill(observation_counts, observation_counts + out_width, 0);
+	}
 
-	// Iterate from left to right of display screen (x = 0 -> 160)
 	for (int x = 0; x < 160; x++)
 	{
-		// 1. Get pixel X,Y in overall background map, offset by ScrollX & Y
-		int map_x = (int)scroll_x + x;
-		int map_y = (int)scroll_y + y;
-
-		// Adjust map coordinates if they exceed the 256x256 area to loop around
-		map_x = (map_x >= 256) ? map_x - 256 : map_x;
-		map_y = (map_y >= 256) ? map_y - 256 : map_y;
-
-		// 2. Get the tile ID where that pixel is located
-		int tile_col = floor(map_x / 8);
-		int tile_row = floor(map_y / 8);
-		int tile_map_id = (tile_row * 32) + tile_col;
-		Address loc = tile_map_location + tile_map_id;
-		Byte tile_id = memory->read(loc);
-
-		// 3. Get the pixel color based on that coordinate relative to the 8x8 tile grid
-		// 4. Plot pixel in 160x144 display view
-		int tile_x_pixel = map_x % 8;
-		int tile_y_pixel = map_y % 8;
-
-		// Invert x pixels because they are stored backwards
-		tile_x_pixel = abs(tile_x_pixel - 7);
-
-		update_bg_tile_pixel(palette, x, y, tile_x_pixel, tile_y_pixel, tile_id);
+		int column = x * out_width / 160;
+		observation_sums[column] += gray[x];
+		observation_counts[column]++;
+	}
+
+	// Last scanline of an output row
+	if (y == 143 || (y + 1) * out_height / 144 != row)
+	{
+		for (int column = 0; column < out_width; column++)
+			observation_buffer[row * out_width + column] = (Byte) (observation_sums[column] / observation_counts[column]);
 	}
 }
 
-void Display::update_window_scanline(Byte current_scanline)
+// Each row of cells is read on its first scanline, so scroll and window changes made
+// partway through the frame show up the same way they do on screen
+void Display::update_tile_observation(Byte current_scanline)
 {
-	// Get current window tile map
-	bool window_code_area = memory->LCDC.is_bit_set(BIT_6);
+	int y = current_scanline;
 
-	Address tile_map_location = (window_code_area) ? 0x9C00 : 0x9800;
+	if (y % 8 == 0 && y < 144)
+	{
+		Address bg_map = memory->LCDC.is_bit_set(BIT_3) ? 0x9C00 : 0x9800;
+		Address window_map = memory->LCDC.is_bit_set(BIT_6) ? 0x9C00 : 0x9800;
+		bool window = memory->LCDC.is_bit_set(BIT_5) && y >= memory->WY.get();
+		int window_x = memory->WX.get() - 7;
+		int window_y = memory->WY.get();
 
-	int window_x = (int) memory->WX.get();
-	int window_y = (int) memory->WY.get();
+		int map_y = (memory->SCY.get() + y) & 0xFF;
+		int scroll_x = memory->SCX.get();
 
-	Byte palette = memory->BGP.get();
-	
-	// For each pixel in the 160x1 scanline:
-	// 1. Calculate where the pixel resides in the overall 256x256 background map
-	// 2. Get the tile ID where that pixel is located
-	// 3. Get the pixel color based on that coordinate relative to the 8x8 tile grid
-	// 4. Plot pixel in 160x144 display view
+		// Maps are in bank 0 whichever bank VBK selects, CGB attributes behind them in bank 1
+		const Byte* tile_ids = memory->vram_bank(0) - 0x8000;
+		const Byte* attributes = memory->vram_bank(1) - 0x8000;
 
-	int y = (int) current_scanline;
-
-	// Iterate from left to right of display screen (x = 0 -> 160)
-	for (int x = 0; x < 160; x++)
-	{
-		// WINDOW IS RELATIVE TO THE SCREEN
-		// Shift X & Y pixels based on window register value
-		int display_x = x + window_x - 7;
-		int display_y = y;
-
-		// 1. Get the tile ID where that pixel is located
-		int tile_col = floor(x / 8);
-		int tile_row = floor((y - window_y) / 8);
-		int tile_map_id = (tile_row * 32) + tile_col;
-		Address loc = tile_map_location + tile_map_id;
-		Byte tile_id = memory->read(loc);
-
-		// 2. Get the pixel color based on that coordinate relative to the 8x8 tile grid
-		// 3. Plot pixel in 160x144 display view
-		int tile_x_pixel = x % 8;
-		int tile_y_pixel = y % 8;
-
-		// Invert x pixels because they are stored backwards
-		tile_x_pixel = abs(tile_x_pixel - 7);
-
-		if (current_scanline == 128)
-			bool breakpoint = true;
-
-		if (current_scanline < window_y)
+		for (int column = 0; column < 20; column++)
 		{
-			window_array.setPixel(x, y, sf::Color::Transparent);
+			int x = column * 8;
+			Address location;
+
+			if (window && x >= window_x)
+				location = window_map + ((y - window_y) / 8) * 32 + (x - window_x) / 8;
+			else
+				location = bg_map + (map_y / 8) * 32 + ((scroll_x + x) & 0xFF) / 8;
+
+			int tile = (tile_data_location(tile_ids[location]) - 0x8000) / 16;
+			if (memory->cgb && is_bit_set(attributes[location], BIT_3))
+				tile += 384;
+
+			tile_observation->tiles[y / 8][column] = tile;
 		}
-		else
+	}
+
+	// Sprites as they are for the end of the frame
+	if (y == 143)
+	{
+		const Byte* oam = memory->direct_pointer(0xFE00);
+
+		for (int sprite_id = 0; sprite_id < 40; sprite_id++)
 		{
-			//window_array.setPixel(x, y, sf::Color::Blue);
-			update_window_tile_pixel(palette, display_x, display_y, tile_x_pixel, tile_y_pixel, tile_id);
+			const Byte* entry = oam + sprite_id * 4;
+			TileObservation::Sprite &sprite = tile_observation->sprites[sprite_id];
+
+			sprite.y = entry[0] - 16;
+			sprite.x = entry[1] - 8;
+			sprite.tile = entry[2];
+			sprite.flags = entry[3];
 		}
 	}
 }
 
-void Display::update_bg_tile_pixel(Byte palette, int display_x, int display_y, int tile_x, int tile_y, Byte tile_id)
+// Background, window and sprites of a scanline. The one renderer behind the images, the
+// observations and frame_hash(): DMG scanlines are palette shades and CGB scanlines are
+// palette entries, both turned into RGBA only when images are drawn. On CGB, LCDC bit 0
+// doesn't turn the background off, it lets sprites go over it whatever the priority
+// bits say
+void Display::compose_scanline(Byte current_scanline)
 {
-	bool bg_char_selection = memory->LCDC.is_bit_set(BIT_4);
+	int y = current_scanline;
+	bool cgb = memory->cgb;
 
-	if (debug_enabled)
+	if (cgb || memory->LCDC.is_bit_set(BIT_0))
 	{
-		bg_char_selection = force_bg_loc;
+		bool high_map = debug_enabled ? force_bg_map : memory->LCDC.is_bit_set(BIT_3);
+		draw_tiles(high_map ? 0x9C00 : 0x9800, memory->SCX.get(), (memory->SCY.get() + y) & 0xFF, 0);
+	}
+	else
+	{
+		fill(line_colors, line_colors + 160, 0);
+		fill(line_attributes, line_attributes + 160, 0);
 	}
 
-	// Figure out where the current background character data is being stored
-	// if selection=0 bg area is 0x8800-0x97FF and tile ID is determined by SIGNED -128 to 127
-	// 0x9000 represents the zero ID address in that range
-	Address bg_data_location = (bg_char_selection) ? 0x8000 : 0x9000;
-	Address offset;
+	int window_x = memory->WX.get() - 7;
+	int window_y = memory->WY.get();
 
-	// 0x8000 - 0x8FFF unsigned 
-	if (bg_char_selection)
+	if (memory->LCDC.is_bit_set(BIT_5) && y >= window_y && window_x < 160)
 	{
-		offset = (tile_id * 16) + bg_data_location;
+		Address window_map = memory->LCDC.is_bit_set(BIT_6) ? 0x9C00 : 0x9800;
+		int start_x = max(window_x, 0);
+		draw_tiles(window_map, start_x - window_x, y - window_y, start_x);
 	}
-	// 0x8800 - 0x97FF signed
-	else
+
+	bool do_sprites = memory->LCDC.is_bit_set(BIT_1);
+	Byte* row = &frame_pixels[y * 160];
+
+	if (cgb)
 	{
-		Byte_Signed direction = (Byte_Signed) tile_id;
-		Byte_2 temp_offset = (bg_data_location) + (direction * 16);
-		offset = (Address) temp_offset;
-	}
+		for (int x = 0; x < 160; x++)
+			row[x] = cgb_palette_entry(CgbPalettes::BACKGROUND, line_attributes[x] & 0x07, line_colors[x]);
 
-	Byte
-		high = memory->read(offset + (tile_y * 2) + 1),
-		low  = memory->read(offset + (tile_y * 2));
+		if (do_sprites)
+			draw_cgb_sprites(current_scanline);
 
-	sf::Color color = get_pixel_color(palette, low, high, tile_x, false);
-	bg_array.setPixel(display_x, display_y, color);
-}
+		if (draw_images)
+		{
+			const uint32_t* colors = &memory->palettes.colors[0][0][0];
+			uint32_t* pixels = &color_frame[y * 160];
 
-void Display::update_window_tile_pixel(Byte palette, int display_x, int display_y, int tile_x, int tile_y, Byte tile_id)
-{
-	if (display_x >= 160 || display_x < 0)
-		return;
-	if (display_y >= 144 || display_y < 0)
+			for (int x = 0; x < 160; x++)
+				pixels[x] = colors[row[x]];
+		}
 		return;
+	}
 
-	bool bg_char_selection = memory->LCDC.is_bit_set(BIT_4);
+	Byte palette = memory->BGP.get();
 
-	if (debug_enabled)
-	{
-		bg_char_selection = force_bg_loc;
-	}
+	for (int x = 0; x < 160; x++)
+		row[x] = (palette >> (line_colors[x] * 2)) & 0x03;
 
-	// Figure out where the current background character data is being stored
-	// if selection=0 bg area is 0x8800-0x97FF and tile ID is determined by SIGNED -128 to 127
-	// 0x9000 represents the zero ID address in that range
-	Address bg_data_location = (bg_char_selection) ? 0x8000 : 0x9000;
-	Address offset;
+	if (do_sprites)
+		draw_sprites(current_scanline);
 
-	// 0x8000 - 0x8FFF unsigned 
-	if (bg_char_selection)
+	if (draw_images)
 	{
-		offset = (tile_id * 16) + bg_data_location;
-	}
-	// 0x8800 - 0x97FF signed
-	else
-	{
-		Byte_Signed direction = (Byte_Signed) tile_id;
-		Byte_2 temp_offset = (bg_data_location) + (direction * 16);
-		offset = (Address) temp_offset;
+		uint32_t* pixels = &color_frame[y * 160];
+
+		for (int x = 0; x < 160; x++)
+			pixels[x] = shade_colors[row[x]];
 	}
+}
 
-	Byte
-		high = memory->read(offset + (tile_y * 2) + 1),
-		low  = memory->read(offset + (tile_y * 2));
+// Index of a colour in CgbPalettes::colors and luminance taken as flat arrays
+Byte Display::cgb_palette_entry(int set, int palette, Byte color)
+{
+	return (Byte) (set * 32 + palette * 4 + color);
+}
+
+// Start of a tile's data, LCDC bit 4 picks unsigned IDs from $8000 or signed IDs around $9000
+Address Display::tile_data_location(Byte tile_id)
+{
+	bool unsigned_ids = debug_enabled ? force_bg_loc : memory->LCDC.is_bit_set(BIT_4);
 
-	sf::Color color = get_pixel_color(palette, low, high, tile_x, false);
+	if (unsigned_ids)
+		return 0x8000 + tile_id * 16;
 
-	window_array.setPixel(display_x, display_y, color);
+	return (Address) (0x9000 + ((Byte_Signed) tile_id) * 16);
 }
 
-void Display::render_sprites()
+// Background or window from a screen x to the end of the line, a tile at a time, as
+// colour numbers. On CGB bank 1 of the map holds each tile's attributes: palette, VRAM
+// bank, flips and priority
+void Display::draw_tiles(Address tile_map_location, int map_x, int map_y, int start_x)
 {
-	Address sprite_data_location = 0xFE00;
-	Byte palette_0 = memory->OBP0.get();
-	Byte palette_1 = memory->OBP1.get();
+	const Byte* tile_ids = memory->vram_bank(0) + (tile_map_location - 0x8000) + (map_y / 8) * 32;
+	const Byte* attributes = memory->vram_bank(1) + (tile_map_location - 0x8000) + (map_y / 8) * 32;
+	bool cgb = memory->cgb;
 
-	bool use_8x16_sprites = memory->LCDC.is_bit_set(BIT_2);
+	int x = start_x;
+
+	while (x < 160)
+	{
+		int column = (map_x & 0xFF) / 8;
+		Byte attribute = cgb ? attributes[column] : 0;
+
+		int tile = (tile_data_location(tile_ids[column]) - 0x8000) / 16;
+		const Byte* row = tile_row((attribute >> 3) & 0x01, tile, (attribute >> 5) & 0x03, map_y % 8);
+
+		for (int tile_x = map_x % 8; tile_x < 8 && x < 160; tile_x++, x++, map_x++)
+		{
+			line_colors[x] = row[tile_x];
+			line_attributes[x] = attribute;
+		}
+	}
+}
+
+// Lower OAM entries are drawn last so they end up on top. Sprites marked behind the
+// background only show over its colour 0
+void Display::draw_sprites(Byte current_scanline)
+{
+	const Byte* oam = memory->direct_pointer(0xFE00);
+	Byte* shades = &frame_pixels[current_scanline * 160];
+
+	int y = current_scanline;
+	int sprite_height = memory->LCDC.is_bit_set(BIT_2) ? 16 : 8;
+	Byte palettes[2] = { memory->OBP0.get(), memory->OBP1.get() };
 
-	// 160 bytes of sprite data / 4 bytes per sprite = 40 potential sprites to render maximum
-	// Start at 39 -> to have right priority
 	for (int sprite_id = 39; sprite_id >= 0; sprite_id--)
 	{
-		Address offset = sprite_data_location + (sprite_id * 4);
-		int y_pos = ((int) memory->read(offset)) - 16;
-		int x_pos = ((int) memory->read(offset + 1)) - 8;
+		const Byte* entry = oam + sprite_id * 4;
+		int sprite_y = entry[0] - 16;
 
-		Byte tile_id = memory->read(offset + 2);
-		Byte flags   = memory->read(offset + 3);
+		if (y < sprite_y || y >= sprite_y + sprite_height)
+			continue;
 
-		bool use_palette_1 = is_bit_set(flags, BIT_4);
-		Byte sprite_palette = (use_palette_1) ? palette_1 : palette_0;
+		int sprite_x = entry[1] - 8;
+		Byte tile_id = entry[2];
+		Byte flags = entry[3];
 
-		// If in 8x16 mode, the tile pattern for top is VAL & 0xFE
-		// Lower 8x8 tile is VAL | 0x1
+		// Vertical flip covers both tiles of a tall sprite, so it's applied here
+		int tile_y = y - sprite_y;
+		if (is_bit_set(flags, BIT_6))
+			tile_y = sprite_height - 1 - tile_y;
+		if (sprite_height == 16)
+			tile_id &= 0xFE;
 
-		if (use_8x16_sprites)
-		{
-			tile_id = tile_id & 0xFE;
-			Byte tile_id_bottom = tile_id | 0x01;
-			render_sprite_tile(sprite_palette, x_pos, y_pos, tile_id, flags);
-			render_sprite_tile(sprite_palette, x_pos, y_pos + 8, tile_id_bottom, flags);
-		}
-		else
+		const Byte* row = tile_row(0, tile_id + tile_y / 8, (flags >> 5) & 0x01, tile_y % 8);
+		Byte palette = palettes[(flags >> 4) & 0x01];
+		bool behind = is_bit_set(flags, BIT_7);
+
+		for (int x = 0; x < 8; x++)
 		{
-			render_sprite_tile(sprite_palette, x_pos, y_pos, tile_id, flags);
+			int pixel_x = sprite_x + x;
+			Byte color = row[x];
+
+			if (pixel_x < 0 || pixel_x >= 160 || color == 0)
+				continue;
+
+			if (behind && line_colors[pixel_x] != 0)
+				continue;
+
+			shades[pixel_x] = (palette >> (color * 2)) & 0x03;
 		}
 	}
 }
 
-void Display::render_sprite_tile(Byte palette, int start_x, int start_y, Byte tile_id, Byte flags)
+// Lower OAM entries are drawn last so they end up on top
+void Display::draw_cgb_sprites(Byte current_scanline)
 {
-	Address sprite_data_location = 0x8000;
-
-	bool priority = is_bit_set(flags, BIT_7);
-	bool mirror_y = is_bit_set(flags, BIT_6);
-	bool mirror_x = is_bit_set(flags, BIT_5);
+	const Byte* oam = memory->direct_pointer(0xFE00);
+	Byte* pixels = &frame_pixels[current_scanline * 160];
 
-	// If set to zero then sprite always rendered above bg
-	// If set to 1, sprite is hidden behind the background and window
-	// unless the color of the background or window is white, it's then rendered on top
-	bool hide_sprite = is_bit_set(flags, BIT_7);
+	int y = current_scanline;
+	int sprite_height = memory->LCDC.is_bit_set(BIT_2) ? 16 : 8;
+	bool bg_priority = memory->LCDC.is_bit_set(BIT_0);
 
-	for (int y = 0; y < 8; y++)
+	for (int sprite_id = 39; sprite_id >= 0; sprite_id--)
 	{
-		int offset = (tile_id * 16) + sprite_data_location;
+		const Byte* entry = oam + sprite_id * 4;
+		int sprite_y = entry[0] - 16;
+
+		if (y < sprite_y || y >= sprite_y + sprite_height)
+			continue;
+
+		int sprite_x = entry[1] - 8;
+		Byte tile_id = entry[2];
+		Byte flags = entry[3];
 
-		Byte
-			high = memory->read(offset + (y * 2) + 1),
-			low  = memory->read(offset + (y * 2));
+		// Vertical flip covers both tiles of a tall sprite, so it's applied here
+		int tile_y = y - sprite_y;
+		if (is_bit_set(flags, BIT_6))
+			tile_y = sprite_height - 1 - tile_y;
+		if (sprite_height == 16)
+			tile_id &= 0xFE;
+
+		const Byte* row = tile_row((flags >> 3) & 0x01, tile_id + tile_y / 8, (flags >> 5) & 0x01, tile_y % 8);
+		int palette = flags & 0x07;
+		bool behind = is_bit_set(flags, BIT_7);
 
 		for (int x = 0; x < 8; x++)
 		{
-			int pixel_x = (mirror_x) ? (start_x + x) : (start_x + 7 - x);
-			int pixel_y = (mirror_y) ? (start_y + 7 - y) : (start_y + y);
-
-			// prevent pixels from being drawn off screen
-			sf::Vector2u bounds = sprites_array.getSize();
+			int pixel_x = sprite_x + x;
+			Byte color = row[x];
 
-			if (pixel_x < 0 || pixel_x >= bounds.x)
+			if (pixel_x < 0 || pixel_x >= 160 || color == 0)
 				continue;
-			if (pixel_y < 0 || pixel_y >= bounds.y)
+
+			// Background colours 1-3 cover sprites marked behind, or tiles marked in front
+			if (bg_priority && line_colors[pixel_x] != 0 && (behind || is_bit_set(line_attributes[pixel_x], BIT_7)))
 				continue;
 
-			sf::Color color = get_pixel_color(palette, low, high, x, true);
-
-			// If color in bg/window is anything but white, hide the sprite pixel
-			sf::Color bg_color = bg_array.getPixel(pixel_x, pixel_y);
-			
-			if (priority)
-			{
-				if (bg_color != shades_of_gray[0x0])
-				{
-					continue;
-					//color = sf::Color::Transparent;
-				}
-			}
-
-			sprites_array.setPixel(pixel_x, pixel_y, color);
+			pixels[pixel_x] = cgb_palette_entry(CgbPalettes::SPRITES, palette, color);
 		}
 	}
 }
 
-// Returns the color of a pixel at X bit based on the 2 relevant line bytes
-sf::Color Display::get_pixel_color(Byte palette, Byte top, Byte bottom, int bit, bool is_sprite)
+const Byte* Display::tile_row(int bank, int tile, int flips, int row)
 {
-	// Figure out what colors to apply to each color code based on the palette data
-	Byte color_3_shade = (palette >> 6);        // extract bits 7 & 6
-	Byte color_2_shade = (palette >> 4) & 0x03; // extract bits 5 & 4
-	Byte color_1_shade = (palette >> 2) & 0x03; // extract bits 3 & 2
-	Byte color_0_shade = (palette & 0x03);      // extract bits 1 & 0
+	if (memory->tile_dirty[bank][tile])
+		decode_tile(bank, tile);
 
-	// Get color code from the two defining bytes
-	Byte first  = (Byte)is_bit_set(top, bit);
-	Byte second = (Byte)is_bit_set(bottom, bit);
-	Byte color_code = (second << 1) | first;
+	return &tile_cache[((bank * 384 + tile) * 4 + flips) * 64 + row * 8];
+}
 
-	sf::Color result;
+void Display::decode_tile(int bank, int tile)
+{
+	const Byte* data = memory->vram_bank(bank) + tile * 16;
+	Byte* variants = &tile_cache[(bank * 384 + tile) * 4 * 64];
 
-	switch (color_code)
+	for (int y = 0; y < 8; y++)
 	{
-		case 0x0: return (is_sprite) ? sf::Color::Transparent : shades_of_gray[color_0_shade];
-		case 0x1: return shades_of_gray[color_1_shade];
-		case 0x2: return shades_of_gray[color_2_shade];
-		case 0x3: return shades_of_gray[color_3_shade];
-		default:  return sf::Color(255, 0, 255); // error color
+		Byte low = data[y * 2], high = data[y * 2 + 1];
+
+		for (int x = 0; x < 8; x++)
+		{
+			int bit = 7 - x;
+			Byte color = (Byte) ((is_bit_set(high, bit) << 1) | is_bit_set(low, bit));
+
+			variants[0 * 64 + y * 8 + x] = color;
+			variants[1 * 64 + y * 8 + (7 - x)] = color;
+			variants[2 * 64 + (7 - y) * 8 + x] = color;
+			variants[3 * 64 + (7 - y) * 8 + (7 - x)] = color;
+		}
 	}
+
+	memory->tile_dirty[bank][tile] = false;
 }
 
 bool Display::is_lcd_enabled()
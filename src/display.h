@@ -4,30 +4,75 @@
 #include <iostream>
 #include "memory.h"
 
+// Frame formats the PPU can write straight into a caller's buffer as each scanline is
+// drawn, one byte per pixel
+enum class Observation
+{
+	NONE,
+	SHADES,     // 160x144 shades after the palette, 0 (white) to 3 (black), luminance on CGB
+	GRAY,       // 160x144 8-bit grayscale
+	GRAY_80x72, // 2x2 averaged grayscale
+	GRAY_84x84  // area resampled grayscale
+};
+
+// Symbolic view of a frame, filled in as it's drawn
+struct TileObservation
+{
+	// Tile covering the top left pixel of each 8x8 cell of the screen, from the background
+	// or window, as a VRAM tile number: 0-255 at $8000, 256-383 at $9000, plus 384 for
+	// tiles in VRAM bank 1 on CGB
+	Byte_2 tiles[18][20];
+
+	// Sprite attribute table in OAM order, in screen coordinates
+	struct Sprite
+	{
+		int16_t x, y;
+		Byte tile;
+		Byte flags;
+	} sprites[40];
+};
+
 class Display
 {
 	public:
 		sf::RenderWindow window;
 		
 		sf::Image bg_array;
-		sf::Image sprites_array;
-		sf::Image window_array;
-
 		sf::Sprite bg_sprite;
-		sf::Sprite sprites_sprite; // lol
-		sf::Sprite window_sprite;
 
 		int width = 160,
 			height = 144;
 
 		bool emulate_pallete = true;
 
+		// No window is created, frames are only kept in the image buffers
+		bool headless = false;
+
+		// Draw into the RGBA image buffers, may be turned off when only observations are used
+		bool draw_images = true;
+
+		// Compose scanlines for frame_hash() even when no image or observation is taken
+		bool hash_frames = false;
+
+		// Observation written to observation_buffer, which holds observation_size() bytes
+		// and belongs to the caller
+		Observation observation = Observation::NONE;
+		Byte* observation_buffer = nullptr;
+		static int observation_size(Observation mode);
+
+		// Tile map and sprite table written here every frame, belongs to the caller
+		TileObservation* tile_observation = nullptr;
+
+		// Identifies the last frame, whether or not images are drawn. Needs hash_frames
+		// when neither images nor observations are
+		uint64_t frame_hash();
+
 		// debug variables
 		bool debug_enabled = false;
 		bool force_bg_map = false;
 		bool force_bg_loc = false;
 
-		void init(Memory* _memory);
+		void init(Memory* _memory, bool _headless = false);
 
 		int scanlines_rendered = 0;
 
@@ -49,17 +94,38 @@ class Display
 			COLOR_BLACK      = 3;
 
 		sf::Color shades_of_gray[4];
+		uint32_t shade_colors[4]; // shades_of_gray as RGBA bytes
 
-		void update_bg_scanline(Byte current_scanline);
-		void update_window_scanline(Byte current_scanline);
-		// TODO: void update_sprite_scanline(Byte current_scanline);
+		// Downsampled observation rows are summed here until all their scanlines are in
+		int observation_sums[160];
+		int observation_counts[160];
 
-		void update_bg_tile_pixel(Byte palette, int display_x, int display_y, int tile_x, int tile_y, Byte tile_id);
-		void update_window_tile_pixel(Byte palette, int display_x, int display_y, int tile_x, int tile_y, Byte tile_id);
-		
-		sf::Color get_pixel_color(Byte palette, Byte top, Byte bottom, int bit, bool is_sprite);
+		void update_observation_scanline(Byte current_scanline);
+		void update_tile_observation(Byte current_scanline);
+		Address tile_data_location(Byte tile_id);
+
+		// -------- SCANLINES -------- //
+
+		// Decoded tiles as colour numbers, 64 per tile for each VRAM bank, tile and flip
+		// (bit 0 horizontal, bit 1 vertical). Decoded again only once Memory flags a
+		// tile as written
+		vector<Byte> tile_cache;
+		const Byte* tile_row(int bank, int tile, int flips, int row);
+		void decode_tile(int bank, int tile);
+
+		// RGBA of the frame being drawn, copied into bg_array once per frame
+		vector<uint32_t> color_frame;
+
+		// DMG palette shades, or CGB palette entries, of the frame being drawn
+		vector<Byte> frame_pixels;
+		static Byte cgb_palette_entry(int set, int palette, Byte color);
+
+		void compose_scanline(Byte current_scanline);
+		void draw_tiles(Address tile_map_location, int map_x, int map_y, int start_x);
+		void draw_sprites(Byte current_scanline);
+		void draw_cgb_sprites(Byte current_scanline);
 
-		void clear_window();
-		void render_sprites();
-		void render_sprite_tile(Byte pallete, int start_x, int start_y, Byte tile_id, Byte flags);
+		// Background colour number and CGB map attributes of each pixel on the scanline
+		Byte line_colors[160];
+		Byte line_attributes[160];
 };
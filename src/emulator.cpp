@@ -1,9 +1,31 @@
 #include "emulator.h"
-
-Emulator::Emulator()
+#include "audio.h"
+#include "net_link.h"
+#include "movie.h"
+#include "heatmap.h"
+#include "perf_counters.h"
+#include "coverage.h"
+
+// Bump STATE_VERSION whenever save_state() changes layout, and MOVIE_VERSION with it
+static const char STATE_MAGIC[4] = { 'G', 'B', 'S', 'T' };
+static const uint32_t STATE_VERSION = 2;
+
+Emulator::Emulator(bool headless)
 {
 	cpu.init(&memory);
-	display.init(&memory);
+	display.init(&memory, headless);
+}
+
+void Emulator::load_rom(string location, bool print_info)
+{
+	memory.load_rom(location, print_info);
+	cpu.reset();
+}
+
+void Emulator::load_rom(const vector<Byte> &buffer, bool print_info)
+{
+	memory.load_rom(buffer, print_info);
+	cpu.reset();
 }
 
 // Start emulation of CPU
@@ -11,33 +33,26 @@ void Emulator::run()
 {
 	sf::Time time;
 
+	// Sound is synthesized on SFML's streaming thread from the queued register writes
+	ApuWriteQueue apu_writes;
+	AudioPlayer audio(apu_writes);
+	attach_audio(&apu_writes);
+	audio.play();
+
 	while(display.window.isOpen())
 	{
-		// CPU cycles to emulate per frame draw
-		float cycles_per_frame = cpu.CLOCK_SPEED / framerate;
 		float time_between_frames = 1000 / framerate;
-		// Current cycle in frame
-		int current_cycle = 0;
 
 		handle_events();
 
-		while (current_cycle < cycles_per_frame)
-		{
-			Opcode code = memory.read(cpu.reg_PC);
-
-			cpu.parse_opcode(code);
-			current_cycle += cpu.num_cycles;
-
-			update_timers(cpu.num_cycles);
-			update_scanline(cpu.num_cycles);
-			do_interrupts();
-			
-			cpu.num_cycles = 0;
-		}
+		if (net_link)
+			net_link->run_frame();
+		else if (movie)
+			movie->run_frame(*this);
+		else
+			run_frame();
 
 		//display.render();
-		//cout << "frame " << current_cycle << endl;
-		current_cycle = 0;
 
 		int frame_time = time.asMilliseconds();
 
@@ -45,9 +60,194 @@ void Emulator::run()
 		if (frame_time < time_between_frames)
 			sf::sleep(sf::milliseconds(sleep_time));
 		time = time.Zero;
-		//cout << display.scanlines_rendered << endl;
-		display.scanlines_rendered = 0;
 	}
+
+	audio.stop();
+	attach_audio(nullptr);
+}
+
+// Emulate one frame worth of CPU cycles, returns true if the game read the joypad
+bool Emulator::run_frame()
+{
+	uint64_t joypad_reads = memory.joypad_reads;
+
+	if (perf_counters)
+		perf_counters->begin_frame();
+
+	// Clock cycles to emulate per frame draw, the CPU runs twice as many in double speed
+	float cycles_per_frame = cpu.CLOCK_SPEED / framerate;
+	// Current cycle in frame
+	int current_cycle = 0;
+
+	while (current_cycle < cycles_per_frame && stop_reason == StopReason::NONE)
+	{
+		current_cycle += step();
+	}
+
+	display.scanlines_rendered = 0;
+
+	if (perf_counters)
+		perf_counters->end_frame();
+
+	frames_run++;
+	if (memory.apu_writes)
+		memory.apu_writes->mark_time();
+	if (memory.write_log)
+		memory.write_log->end_frame(frames_run);
+
+	input_polled = (memory.joypad_reads != joypad_reads);
+	if (!input_polled)
+		lag_frames++;
+
+	return input_polled;
+}
+
+// Run until the emulated clock reaches the given cycle. Returns true when stopped
+// early because a serial transfer using the internal clock was started.
+bool Emulator::run_until(uint64_t cycle)
+{
+	serial_started = false;
+
+	while (cycles_run < cycle)
+	{
+		step();
+
+		if (serial_started)
+			break;
+	}
+
+	if (memory.apu_writes)
+		memory.apu_writes->mark_time();
+
+	return serial_started;
+}
+
+// Execute a single instruction and update the hardware around it,
+// returns the number of 4 MHz clock cycles taken
+int Emulator::step()
+{
+	if (perf_counters)
+		perf_counters->begin_step();
+
+	// A halted CPU steps over the same HALT until an interrupt, it only ran it once
+	if (!cpu.halted)
+	{
+		if (memory.heatmap)
+			memory.heatmap->count(AccessHeatmap::EXECUTE, cpu.reg_PC, memory.get_rom_bank(), memory.get_ram_bank());
+
+		if (coverage)
+			coverage->count(memory.fetch(cpu.reg_PC), memory.fetch(cpu.reg_PC + 1), cpu.reg_F);
+	}
+
+	if (reference_core)
+		cpu.parse_opcode(memory.fetch(cpu.reg_PC));
+	else
+		cpu.step();
+
+	// DMA stalls are charged to the instruction that started them, the rest of the
+	// hardware keeps running through them
+	int cycles = cpu.num_cycles;
+	int stall_cycles = memory.stall_cycles << memory.speed_shift;
+	memory.stall_cycles = 0;
+
+	// Timers and serial run off the CPU clock, the PPU and everything counted in
+	// cycles_run off the fixed 4 MHz clock, half as many cycles in double speed
+	int clock_cycles = (cycles + stall_cycles) >> memory.speed_shift;
+	cycles_run += clock_cycles;
+
+	if (perf_counters)
+	{
+		// Same work as below, with the counters read around each subsystem. Stalls are
+		// charged to the PPU, most of their time goes into scanlines
+		perf_counters->end_phase(PerfCounters::CPU_CORE);
+		update_timers(cycles);
+		update_serial(cycles);
+		perf_counters->end_phase(PerfCounters::TIMERS);
+		update_scanline(cycles >> memory.speed_shift);
+		run_stall(stall_cycles);
+		perf_counters->end_phase(PerfCounters::PPU);
+		do_interrupts();
+		perf_counters->end_phase(PerfCounters::CPU_CORE);
+	}
+	else
+	{
+		update_timers(cycles);
+		update_serial(cycles);
+		update_scanline(cycles >> memory.speed_shift);
+		run_stall(stall_cycles);
+		do_interrupts();
+	}
+
+	cpu.num_cycles = 0;
+
+	// Only an interrupt can end HALT, and none can be serviced with IE clear
+	if (cpu.halted && memory.IE.get() == 0)
+		cpu.stop_reason = StopReason::HALT_FOREVER;
+
+	if (cpu.stop_reason != StopReason::NONE)
+		stop_reason = cpu.stop_reason;
+
+	return clock_cycles;
+}
+
+// Run the hardware through CPU cycles spent stalled on a DMA, in slices short enough
+// that no divider, timer, serial or scanline period is skipped over
+void Emulator::run_stall(int cycles)
+{
+	while (cycles > 0)
+	{
+		int slice = min(cycles, STALL_SLICE);
+		cycles -= slice;
+
+		update_timers(slice);
+		update_serial(slice);
+		update_scanline(slice >> memory.speed_shift);
+	}
+}
+
+// Hold the given INPUT_* buttons, replacing whatever was pressed before
+void Emulator::set_joypad(Byte input)
+{
+	Byte buttons = ~input & 0x0F;
+	Byte arrows = (~input >> 4) & 0x0F;
+
+	// Newly pressed buttons raise the joypad interrupt, same as a key press
+	if ((memory.joypad_buttons & ~buttons) || (memory.joypad_arrows & ~arrows))
+		request_interrupt(INTERRUPT_JOYPAD);
+
+	memory.joypad_buttons = buttons;
+	memory.joypad_arrows = arrows;
+}
+
+// Log every memory write from now on, nullptr turns logging off again
+void Emulator::attach_write_log(WriteLog* log)
+{
+	memory.write_log = log;
+
+	if (log)
+	{
+		log->clock = &cycles_run;
+		log->reset();
+	}
+}
+
+// Queue sound register writes for an audio thread from now on, nullptr discards them again
+void Emulator::attach_audio(ApuWriteQueue* queue)
+{
+	memory.apu_writes = queue;
+
+	if (queue)
+	{
+		queue->clock = &cycles_run;
+		queue_sound_registers();
+		queue->mark_time();
+	}
+}
+
+// The INPUT_* buttons currently held
+Byte Emulator::get_joypad()
+{
+	return ~(memory.joypad_buttons | (memory.joypad_arrows << 4));
 }
 
 // Hanlde window events and IO
@@ -80,6 +280,8 @@ void Emulator::key_pressed(Key key)
 		int id = key - 84;
 		if (sf::Keyboard::isKeyPressed(Key::LShift))
 			save_state(id);
+		else if (movie)
+			cout << "save states can't be loaded into a movie, it would no longer replay" << endl;
 		else
 			load_state(id);
 		return;
@@ -243,6 +445,33 @@ void Emulator::set_timer_frequency()
 	}
 }
 
+// Serial transfers clocked by the gameboy itself shift 8 bits at 8192 Hz
+void Emulator::update_serial(int cycles)
+{
+	if (serial_counter == 0)
+	{
+		// Transfer start flag set with the internal clock selected
+		if ((memory.SC.get() & 0x81) == 0x81)
+		{
+			serial_counter = 8 * 512;
+			serial_incoming = 0xFF;
+			serial_started = true;
+			serial_output.push_back(memory.SB.get());
+		}
+		return;
+	}
+
+	serial_counter -= cycles;
+
+	if (serial_counter <= 0)
+	{
+		serial_counter = 0;
+		memory.SB.set(serial_incoming);
+		memory.SC.clear_bit(BIT_7);
+		request_interrupt(INTERRUPT_SERIAL);
+	}
+}
+
 void Emulator::request_interrupt(Byte id)
 {
 	memory.IF.set_bit(id);
@@ -286,6 +515,9 @@ void Emulator::service_interrupt(Byte id)
 	cpu.interrupt_master_enable = false;
 	memory.IF.clear_bit(id);
 
+	// The handler may push AF, so flag updates the block decoder deferred are due now
+	cpu.resolve_flags();
+
 	// Push current execution address to stack
 	memory.write(--cpu.reg_SP, high_byte(cpu.reg_PC));
 	memory.write(--cpu.reg_SP, low_byte(cpu.reg_PC));
@@ -350,7 +582,13 @@ void Emulator::set_lcd_status()
 			{
 				// draw current scanline to screen
 				if (current_line < 144 && display.scanlines_rendered <= 144)
+				{
+					// check_frozen() hashes frames nothing else may be composing
+					display.hash_frames = freeze_seconds > 0;
 					display.update_scanline(current_line);
+				}
+
+				memory.hblank();
 			}
 
 			// 0 binary
@@ -404,6 +642,9 @@ void Emulator::update_scanline(int cycles)
 			request_interrupt(INTERRUPT_VBLANK);
 			if (display.scanlines_rendered <= 144)
 				display.render();
+
+			if (freeze_seconds > 0)
+				check_frozen();
 		}
 		// Reset counter if past maximum
 		else if (current_scanline > 153)
@@ -411,6 +652,23 @@ void Emulator::update_scanline(int cycles)
 	}
 }
 
+// A game showing the same frame without reading the joypad is waiting on nothing
+void Emulator::check_frozen()
+{
+	uint64_t frame_hash = display.frame_hash();
+
+	if (frame_hash == last_frame_hash && memory.joypad_reads == last_joypad_reads)
+		frozen_frames++;
+	else
+		frozen_frames = 0;
+
+	last_frame_hash = frame_hash;
+	last_joypad_reads = memory.joypad_reads;
+
+	if (frozen_frames >= freeze_seconds * framerate)
+		stop_reason = StopReason::FROZEN;
+}
+
 void Emulator::save_state(int id)
 {
 	ofstream file;
@@ -419,8 +677,7 @@ void Emulator::save_state(int id)
 
 	if (!file.bad())
 	{
-		cpu.save_state(file);
-		memory.save_state(file);
+		save_state(file);
 		file.close();
 
 		cout << "wrote save state " << id << endl;
@@ -432,12 +689,111 @@ void Emulator::load_state(int id)
 	string filename = "./saves/" + memory.rom_name + "_" + to_string(id) + ".sav";
 	ifstream file(filename, ios::binary);
 
-	if (file.is_open())
-	{
-		cpu.load_state(file);
-		memory.load_state(file);
-		file.close();
+	if (!file.is_open())
+		return;
 
+	if (load_state(file))
 		cout << "loaded state " << id << endl;
+	else
+		cout << "save state " << id << " was written by a different version, not loaded" << endl;
+}
+
+// Hashes the save_state() bytes, so nothing a state restores is left out. The cycle
+// count is zeroed first, the same machine reached at different times hashes the same
+uint64_t Emulator::state_hash()
+{
+	uint64_t cycles = cycles_run;
+	cycles_run = 0;
+
+	stringstream state;
+	save_state(state);
+	cycles_run = cycles;
+
+	string data = state.str();
+	return hash_bytes((const Byte*) data.data(), data.size());
+}
+
+void Emulator::save_state(ostream &file)
+{
+	file.write(STATE_MAGIC, sizeof(STATE_MAGIC));
+	file.write((char*)&STATE_VERSION, sizeof(STATE_VERSION));
+
+	cpu.resolve_flags();
+	cpu.save_state(file);
+	memory.save_state(file);
+
+	// Interrupt and hardware counters
+	file.write((char*)&cpu.interrupt_master_enable, sizeof(cpu.interrupt_master_enable));
+	file.write((char*)&cpu.halted, sizeof(cpu.halted));
+	file.write((char*)&divider_counter, sizeof(divider_counter));
+	file.write((char*)&timer_counter, sizeof(timer_counter));
+	file.write((char*)&timer_frequency, sizeof(timer_frequency));
+	file.write((char*)&scanline_counter, sizeof(scanline_counter));
+	file.write((char*)&serial_counter, sizeof(serial_counter));
+	file.write((char*)&serial_incoming, sizeof(serial_incoming));
+	file.write((char*)&cycles_run, sizeof(cycles_run));
+	file.write((char*)&memory.joypad_buttons, sizeof(memory.joypad_buttons));
+	file.write((char*)&memory.joypad_arrows, sizeof(memory.joypad_arrows));
+}
+
+// Refuses states written by another version of the emulator, leaving the machine untouched
+bool Emulator::load_state(istream &file)
+{
+	char magic[4];
+	uint32_t version;
+
+	file.read(magic, sizeof(magic));
+	file.read((char*)&version, sizeof(version));
+
+	if (!file || !equal(magic, magic + 4, STATE_MAGIC) || version != STATE_VERSION)
+		return false;
+
+	cpu.load_state(file);
+	memory.load_state(file);
+
+	file.read((char*)&cpu.interrupt_master_enable, sizeof(cpu.interrupt_master_enable));
+	file.read((char*)&cpu.halted, sizeof(cpu.halted));
+	file.read((char*)&divider_counter, sizeof(divider_counter));
+	file.read((char*)&timer_counter, sizeof(timer_counter));
+	file.read((char*)&timer_frequency, sizeof(timer_frequency));
+	file.read((char*)&scanline_counter, sizeof(scanline_counter));
+	file.read((char*)&serial_counter, sizeof(serial_counter));
+	file.read((char*)&serial_incoming, sizeof(serial_incoming));
+	file.read((char*)&cycles_run, sizeof(cycles_run));
+	file.read((char*)&memory.joypad_buttons, sizeof(memory.joypad_buttons));
+	file.read((char*)&memory.joypad_arrows, sizeof(memory.joypad_arrows));
+
+	cpu.stop_reason = StopReason::NONE;
+	stop_reason = StopReason::NONE;
+	frozen_frames = 0;
+
+	if (memory.apu_writes)
+	{
+		memory.apu_writes->restart();
+		queue_sound_registers();
+		memory.apu_writes->mark_time();
+	}
+
+	return true;
+}
+
+// Hand the audio thread the current sound registers, after attaching or loading a state.
+// Trigger bits are left out, channels start again on the game's next trigger
+void Emulator::queue_sound_registers()
+{
+	ApuWriteQueue* queue = memory.apu_writes;
+
+	queue->push(0xFF26, 0x00);
+	queue->push(0xFF26, memory.peek(0xFF26));
+
+	for (Address location = 0xFF10; location <= 0xFF3F; location++)
+	{
+		if (location == 0xFF26)
+			continue;
+
+		Byte value = memory.peek(location);
+		bool frequency_high = (location == 0xFF14 || location == 0xFF19 || location == 0xFF1E || location == 0xFF23);
+
+		queue->push(location, frequency_high ? (value & 0x7F) : value);
 	}
 }
@@ -9,18 +9,92 @@
 
 typedef sf::Keyboard::Key Key;
 
+class NetLink;
+class Movie;
+class PerfCounters;
+class OpcodeCoverage;
+
+// Joypad input held for a frame, a bit is set while the button is pressed
+const Byte
+	INPUT_A      = 0x01,
+	INPUT_B      = 0x02,
+	INPUT_SELECT = 0x04,
+	INPUT_START  = 0x08,
+	INPUT_RIGHT  = 0x10,
+	INPUT_LEFT   = 0x20,
+	INPUT_UP     = 0x40,
+	INPUT_DOWN   = 0x80;
+
 class Emulator
 {
 	public:
 
-		Emulator();
+		Emulator(bool headless = false);
+
+		// Load the cartridge and start the CPU the way the boot ROM leaves it for that
+		// cartridge, in CGB mode for colour games
+		void load_rom(string location, bool print_info = true);
+		void load_rom(const vector<Byte> &buffer, bool print_info = true);
+
 		void run();
+		bool run_frame();
+		bool run_until(uint64_t cycle);
+		int step();
+		void set_joypad(Byte input);
+		void attach_write_log(WriteLog* log);
+		void attach_audio(ApuWriteQueue* queue);
+		Byte get_joypad();
 		CPU cpu;
 		Memory memory;
 		Display display;
 
+		// Run CPU::parse_opcode() directly instead of the block decoding CPU::step()
+		bool reference_core = false;
+
+		// Complete machine state, used for save slots and in-memory snapshots.
+		// load_state() returns false for a state from another version
+		void save_state(ostream &file);
+		bool load_state(istream &file);
+
+		// Identifies the machine state for comparisons, leaving out the cycle count
+		uint64_t state_hash();
+
+		// Frames are advanced through this link when playing over the network
+		NetLink* net_link = nullptr;
+
+		// Frames are played back from or recorded into this movie
+		Movie* movie = nullptr;
+
+		// Set when the game can no longer make progress, run_frame() returns early once set
+		StopReason stop_reason = StopReason::NONE;
+
+		// Emulated seconds of identical frames without joypad polling before the
+		// game counts as frozen, 0 disables the check
+		float freeze_seconds = 0;
+
+		// Frames run with run_frame(), and the lag frames among them where the game
+		// never read P1 so the joypad state had no effect
+		uint64_t frames_run = 0;
+		uint64_t lag_frames = 0;
+		bool input_polled = false; // P1 was read during the last frame
+
+		// Executed instructions are counted here when set
+		OpcodeCoverage* coverage = nullptr;
+
+		// Host performance counters read every frame when set
+		PerfCounters* perf_counters = nullptr;
+
+		// Clock cycles emulated since power on
+		uint64_t cycles_run = 0;
+
+		// Every byte shifted out over the serial port
+		vector<Byte> serial_output;
+
 	private:
 
+		friend class LinkCable;
+		friend class NetLink;
+
 		float framerate = 60;
 
 		// -------- EVENTS ------- //
@@ -48,11 +122,32 @@ class Emulator
 		Byte get_timer_frequency();
 		void set_timer_frequency();
 
+		// --------- SERIAL --------- //
+		int serial_counter = 0; // clock cycles left in the current transfer
+		Byte serial_incoming = 0xFF; // byte shifted in, 0xFF when nothing is connected
+		bool serial_started = false; // a transfer using the internal clock just started
+		void update_serial(int cycles);
+
 		// ------- INTERRUPTS ------- //
 		void request_interrupt(Byte id);
 		void do_interrupts();
 		void service_interrupt(Byte id);
 
+		// ------ LOCK UPS ------ //
+		uint64_t last_frame_hash = 0;
+		uint64_t last_joypad_reads = 0;
+		int frozen_frames = 0;
+		void check_frozen();
+
+		// -------- SOUND -------- //
+		void queue_sound_registers();
+
+		// --------- DMA STALLS --------- //
+		// Each update advances the divider, TIMA, serial and LY by at most one period,
+		// stalls are run in slices no longer than the fastest of them, TIMA at 262144 Hz
+		static const int STALL_SLICE = 16;
+		void run_stall(int cycles);
+
 		// ------ LCD Display ------ //
 		int scanline_counter = 456; // Clock cycles per scanline draw
 		void set_lcd_status();
@@ -0,0 +1,80 @@
+#include "heatmap.h"
+
+AccessHeatmap::AccessHeatmap(size_t rom_size)
+{
+	for (int access = 0; access < 3; access++)
+	{
+		address_counts[access].assign(0x10000, 0);
+		rom_counts[access].assign(rom_size, 0);
+		ram_counts[access].assign(0x8000, 0);
+	}
+}
+
+void AccessHeatmap::clear()
+{
+	for (int access = 0; access < 3; access++)
+	{
+		fill(address_counts[access].begin(), address_counts[access].end(), 0);
+		fill(rom_counts[access].begin(), rom_counts[access].end(), 0);
+		fill(ram_counts[access].begin(), ram_counts[access].end(), 0);
+	}
+}
+
+bool AccessHeatmap::save(string location)
+{
+	ofstream file(location, ios::binary | ios::trunc);
+
+	if (!file.is_open())
+		return false;
+
+	uint32_t rom_size = (uint32_t) rom_counts[READ].size();
+	uint32_t ram_size = (uint32_t) ram_counts[READ].size();
+
+	file.write("GBHM", 4);
+	file.write((char*)&rom_size, sizeof(rom_size));
+	file.write((char*)&ram_size, sizeof(ram_size));
+
+	for (int access = 0; access < 3; access++)
+	{
+		file.write((char*)address_counts[access].data(), address_counts[access].size() * sizeof(uint32_t));
+		file.write((char*)rom_counts[access].data(), rom_counts[access].size() * sizeof(uint32_t));
+		file.write((char*)ram_counts[access].data(), ram_counts[access].size() * sizeof(uint32_t));
+	}
+
+	return !file.bad();
+}
+
+bool AccessHeatmap::save_png(string prefix)
+{
+	return save_image(prefix + "_address.png", address_counts, 0x10000)
+		&& save_image(prefix + "_rom.png", rom_counts, rom_counts[READ].size())
+		&& save_image(prefix + "_ram.png", ram_counts, ram_counts[READ].size());
+}
+
+bool AccessHeatmap::save_image(string location, vector<uint32_t>* counts, size_t size)
+{
+	const unsigned int width = 256;
+	unsigned int height = (unsigned int) max((size_t) 1, (size + width - 1) / width);
+
+	// Each access type is scaled against its own busiest byte
+	double scale[3];
+	for (int access = 0; access < 3; access++)
+	{
+		uint32_t highest = counts[access].empty() ? 0 : *max_element(counts[access].begin(), counts[access].end());
+		scale[access] = (highest > 0) ? 255.0 / log(1.0 + highest) : 0;
+	}
+
+	sf::Image image;
+	image.create(width, height, sf::Color::Black);
+
+	for (size_t i = 0; i < size; i++)
+	{
+		Byte red   = (Byte) (log(1.0 + counts[READ][i]) * scale[READ]);
+		Byte blue  = (Byte) (log(1.0 + counts[WRITE][i]) * scale[WRITE]);
+		Byte green = (Byte) (log(1.0 + counts[EXECUTE][i]) * scale[EXECUTE]);
+
+		image.setPixel((unsigned int) (i % width), (unsigned int) (i / width), sf::Color(red, green, blue));
+	}
+
+	return image.saveToFile(location);
+}
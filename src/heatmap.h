@@ -0,0 +1,68 @@
+#pragma once
+
+#include <SFML\Graphics.hpp>
+#include "types.h"
+
+// Read, write and execute counts for every address of the 64kB address space, and for
+// every byte of cartridge ROM and RAM by bank so hot banks stand out
+class AccessHeatmap
+{
+	public:
+
+		enum Access
+		{
+			READ = 0,
+			WRITE = 1,
+			EXECUTE = 2
+		};
+
+		AccessHeatmap(size_t rom_size);
+
+		// Indexed by Access
+		vector<uint32_t> address_counts[3]; // $0000 - $FFFF
+		vector<uint32_t> rom_counts[3];     // bank * $4000 + offset
+		vector<uint32_t> ram_counts[3];     // bank * $2000 + offset
+
+		void count(Access access, Address location, Byte rom_bank, Byte ram_bank)
+		{
+			address_counts[access][location]++;
+
+			size_t index;
+
+			// Writes to ROM only select banks
+			if (location < 0x8000 && access == WRITE)
+				return;
+
+			if (location < 0x4000)
+				index = location;
+			else if (location < 0x8000)
+				index = rom_bank * 0x4000 + (location - 0x4000);
+			else if (location >= 0xA000 && location < 0xC000)
+			{
+				index = ram_bank * 0x2000 + (location - 0xA000);
+				if (index < ram_counts[access].size())
+					ram_counts[access][index]++;
+				return;
+			}
+			else
+				return;
+
+			if (index < rom_counts[access].size())
+				rom_counts[access][index]++;
+		}
+
+		void clear();
+
+		// Raw counts: "GBHM" rom_size:u32 ram_size:u32, then the address, ROM and RAM
+		// counts for reads, writes and executes in that order
+		bool save(string location);
+
+		// <prefix>_address.png is 256x256 with one pixel per address, <prefix>_rom.png and
+		// <prefix>_ram.png are 256 pixels wide with one row per 256 bytes. Reads are red,
+		// writes blue and executes green, on a log scale
+		bool save_png(string prefix);
+
+	private:
+
+		bool save_image(string location, vector<uint32_t>* counts, size_t size);
+};
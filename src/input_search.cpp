@@ -0,0 +1,240 @@
+#include "input_search.h"
+
+#include <condition_variable>
+#include <map>
+#include <thread>
+
+InputSearch::InputSearch(string _rom_location)
+	: expanded(0), duplicates(0), lag_skipped(0), rom_location(_rom_location), found(false)
+{
+	threads = max(1u, thread::hardware_concurrency());
+}
+
+bool InputSearch::run(const string &start_state)
+{
+	workers.clear();
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		workers.push_back(unique_ptr<Emulator>(new Emulator(true)));
+		workers.back()->load_rom(rom_location, false);
+	}
+
+	Emulator &first = *workers[0];
+
+	if (!start_state.empty())
+	{
+		stringstream state(start_state);
+		first.load_state(state);
+	}
+
+	Node root;
+	stringstream state;
+	first.save_state(state);
+	root.state = state.str();
+	root.score = score ? score(first) : 0;
+	root.reached_goal = goal && goal(first);
+
+	visited.clear();
+	visited.insert(first.state_hash());
+
+	expanded = 0;
+	duplicates = 0;
+	lag_skipped = 0;
+	found = false;
+	solution.clear();
+	best_score = root.score;
+
+	if (root.reached_goal)
+	{
+		found = true;
+		return true;
+	}
+
+	return (mode == BEAM) ? run_beam(root) : run_best_first(root);
+}
+
+// Breadth first by frame, keeping only the best beam_width nodes of each generation
+bool InputSearch::run_beam(Node &root)
+{
+	vector<Node> beam;
+	beam.push_back(root);
+
+	for (int frame = 0; frame < max_frames && !beam.empty(); frame++)
+	{
+		vector<Node> next;
+		mutex next_lock;
+		atomic<size_t> next_parent(0);
+
+		vector<thread> pool;
+
+		for (unsigned int i = 0; i < threads; i++)
+		{
+			pool.push_back(thread([&, i]()
+			{
+				vector<Node> children;
+
+				for (size_t id = next_parent++; id < beam.size() && !found; id = next_parent++)
+					expand(*workers[i], beam[id], children);
+
+				lock_guard<mutex> lock(next_lock);
+				for (Node &child : children)
+					next.push_back(move(child));
+			}));
+		}
+
+		for (thread &worker : pool)
+			worker.join();
+
+		if (found || expanded >= max_expansions)
+			break;
+
+		stable_sort(next.begin(), next.end(), [](const Node &a, const Node &b) { return a.score > b.score; });
+
+		if ((int) next.size() > beam_width)
+			next.resize(beam_width);
+
+		beam = move(next);
+	}
+
+	return found;
+}
+
+// Workers share an open list ordered by score, the worst nodes are dropped once it
+// holds more than max_open
+bool InputSearch::run_best_first(Node &root)
+{
+	multimap<double, Node> open;
+	mutex open_lock;
+	condition_variable open_changed;
+	int busy = 0;
+
+	open.emplace(root.score, root);
+
+	vector<thread> pool;
+
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		pool.push_back(thread([&, i]()
+		{
+			while (true)
+			{
+				Node node;
+				{
+					unique_lock<mutex> lock(open_lock);
+					open_changed.wait(lock, [&]() { return !open.empty() || busy == 0 || found; });
+
+					if (found || open.empty() || expanded >= max_expansions)
+						break;
+
+					auto best = prev(open.end());
+					node = move(best->second);
+					open.erase(best);
+					busy++;
+				}
+
+				vector<Node> children;
+				if ((int) node.inputs.size() < max_frames)
+					expand(*workers[i], node, children);
+
+				{
+					lock_guard<mutex> lock(open_lock);
+
+					for (Node &child : children)
+						open.emplace(child.score, move(child));
+
+					while (open.size() > max_open)
+						open.erase(open.begin());
+
+					busy--;
+				}
+
+				open_changed.notify_all();
+			}
+
+			open_changed.notify_all();
+		}));
+	}
+
+	for (thread &worker : pool)
+		worker.join();
+
+	return found;
+}
+
+// Run one frame from the parent's state for every input in the alphabet
+void InputSearch::expand(Emulator &emulator, const Node &parent, vector<Node> &children)
+{
+	for (size_t i = 0; i < alphabet.size(); i++)
+	{
+		stringstream parent_state(parent.state);
+		emulator.load_state(parent_state);
+
+		emulator.set_joypad(alphabet[i]);
+		emulator.run_frame();
+		expanded++;
+
+		// The game never looked at the joypad, every other input leads to the same state
+		bool lag_frame = !emulator.input_polled && !emulator.memory.IE.is_bit_set(INTERRUPT_JOYPAD);
+
+		if (emulator.stop_reason == StopReason::NONE && visited.insert(emulator.state_hash()))
+		{
+			Node child;
+			stringstream state;
+			emulator.save_state(state);
+			child.state = state.str();
+			child.inputs = parent.inputs;
+			child.inputs.push_back(alphabet[i]);
+			child.score = score ? score(emulator) : 0;
+			child.reached_goal = goal && goal(emulator);
+
+			record_result(child);
+
+			if (child.reached_goal)
+				return;
+
+			children.push_back(move(child));
+		}
+		else
+			duplicates++;
+
+		if (lag_frame)
+		{
+			lag_skipped += alphabet.size() - i - 1;
+			break;
+		}
+	}
+}
+
+void InputSearch::record_result(const Node &node)
+{
+	lock_guard<mutex> lock(result_lock);
+
+	if (found)
+		return;
+
+	if (node.reached_goal || solution.empty() || node.score > best_score)
+	{
+		solution = node.inputs;
+		best_score = node.score;
+	}
+
+	if (node.reached_goal)
+		found = true;
+}
+
+bool InputSearch::VisitedTable::insert(uint64_t hash)
+{
+	int shard = (int) (hash >> 58) % SHARDS;
+
+	lock_guard<mutex> lock(locks[shard]);
+	return shards[shard].insert(hash).second;
+}
+
+void InputSearch::VisitedTable::clear()
+{
+	for (int i = 0; i < SHARDS; i++)
+	{
+		lock_guard<mutex> lock(locks[i]);
+		shards[i].clear();
+	}
+}
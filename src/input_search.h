@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_set>
+
+#include "emulator.h"
+
+// Searches for a sequence of per-frame joypad inputs that reaches an objective, starting
+// from a saved state. Each worker thread has its own headless emulator and expands nodes
+// by restoring their snapshot and running one frame per input in the alphabet. States
+// already reached by any worker are pruned through a shared visited table, and on frames
+// where the game never read the joypad only the first input is tried.
+class InputSearch
+{
+	public:
+
+		enum Mode
+		{
+			BEAM,      // keep the best beam_width nodes of each frame
+			BEST_FIRST // always expand the best scoring node seen so far
+		};
+
+		InputSearch(string rom_location);
+
+		// Objective: the search succeeds once goal returns true, score ranks the
+		// remaining nodes (higher is better)
+		function<bool(Emulator&)> goal;
+		function<double(Emulator&)> score;
+
+		// Inputs to try every frame, INPUT_* bits
+		vector<Byte> alphabet = { 0, INPUT_A, INPUT_B, INPUT_START, INPUT_SELECT,
+			INPUT_RIGHT, INPUT_LEFT, INPUT_UP, INPUT_DOWN };
+
+		Mode mode = BEAM;
+		int beam_width = 64;
+		int max_frames = 600;
+		long max_expansions = 1000000;
+		size_t max_open = 4096; // nodes kept waiting for expansion in best first mode
+		unsigned int threads;
+
+		// Starts from a state written by Emulator::save_state, or power on if empty.
+		// Returns true if the goal was reached, the inputs are left in solution.
+		bool run(const string &start_state = "");
+
+		vector<Byte> solution;
+		double best_score = 0;
+
+		// Statistics of the last run
+		atomic<long> expanded;
+		atomic<long> duplicates;
+		atomic<long> lag_skipped;
+
+	private:
+
+		struct Node
+		{
+			string state;
+			vector<Byte> inputs;
+			double score = 0;
+			bool reached_goal = false;
+		};
+
+		// Hashes of every state reached, sharded so workers rarely contend for a lock
+		class VisitedTable
+		{
+			public:
+				bool insert(uint64_t hash); // false if the state was seen before
+				void clear();
+
+			private:
+				static const int SHARDS = 64;
+				unordered_set<uint64_t> shards[SHARDS];
+				mutex locks[SHARDS];
+		};
+
+		string rom_location;
+		vector<unique_ptr<Emulator>> workers;
+		VisitedTable visited;
+
+		mutex result_lock;
+		atomic<bool> found;
+
+		bool run_beam(Node &root);
+		bool run_best_first(Node &root);
+		void expand(Emulator &emulator, const Node &parent, vector<Node> &children);
+		void record_result(const Node &node);
+};
@@ -0,0 +1,176 @@
+#include "json.h"
+
+#include <stdexcept>
+
+static const JsonValue null_value;
+
+const JsonValue& JsonValue::operator[](const string &key) const
+{
+	for (const pair<string, JsonValue> &member : members)
+	{
+		if (member.first == key)
+			return member.second;
+	}
+
+	return null_value;
+}
+
+const JsonValue& JsonValue::operator[](size_t index) const
+{
+	return (index < items.size()) ? items[index] : null_value;
+}
+
+size_t JsonValue::size() const
+{
+	return (type == OBJECT) ? members.size() : items.size();
+}
+
+// Recursive descent parser over the raw document
+class JsonParser
+{
+	public:
+		JsonParser(const string &_source) : source(_source) {}
+
+		JsonValue parse_value()
+		{
+			skip_whitespace();
+
+			if (position >= source.size())
+				throw runtime_error("unexpected end of JSON");
+
+			JsonValue value;
+			char c = source[position];
+
+			switch (c)
+			{
+				case '{':
+					value.type = JsonValue::OBJECT;
+					position++;
+					if (!consume('}'))
+					{
+						do
+						{
+							skip_whitespace();
+							string key = parse_string();
+							expect(':');
+							value.members.push_back(make_pair(key, parse_value()));
+						} while (consume(','));
+						expect('}');
+					}
+					break;
+				case '[':
+					value.type = JsonValue::ARRAY;
+					position++;
+					if (!consume(']'))
+					{
+						do
+						{
+							value.items.push_back(parse_value());
+						} while (consume(','));
+						expect(']');
+					}
+					break;
+				case '"':
+					value.type = JsonValue::STRING;
+					value.text = parse_string();
+					break;
+				case 't':
+					value.type = JsonValue::BOOLEAN;
+					value.boolean = true;
+					position += 4;
+					break;
+				case 'f':
+					value.type = JsonValue::BOOLEAN;
+					position += 5;
+					break;
+				case 'n':
+					position += 4;
+					break;
+				default:
+				{
+					const char* start = source.c_str() + position;
+					char* end;
+					value.type = JsonValue::NUMBER;
+					value.number = strtod(start, &end);
+					if (end == start)
+						throw runtime_error("invalid JSON value");
+					position += end - start;
+				}
+			}
+
+			return value;
+		}
+
+	private:
+		const string &source;
+		size_t position = 0;
+
+		void skip_whitespace()
+		{
+			while (position < source.size() && isspace((unsigned char) source[position]))
+				position++;
+		}
+
+		bool consume(char c)
+		{
+			skip_whitespace();
+			if (position < source.size() && source[position] == c)
+			{
+				position++;
+				return true;
+			}
+			return false;
+		}
+
+		void expect(char c)
+		{
+			if (!consume(c))
+				throw runtime_error(string("expected '") + c + "' in JSON");
+		}
+
+		string parse_string()
+		{
+			expect('"');
+			string result;
+
+			while (position < source.size() && source[position] != '"')
+			{
+				char c = source[position++];
+
+				if (c == '\\' && position < source.size())
+				{
+					char escaped = source[position++];
+					switch (escaped)
+					{
+						case 'n': result.push_back('\n'); break;
+						case 't': result.push_back('\t'); break;
+						case 'r': result.push_back('\r'); break;
+						case 'b': result.push_back('\b'); break;
+						case 'f': result.push_back('\f'); break;
+						case 'u': result.push_back('?'); position += 4; break; // not needed for test data
+						default:  result.push_back(escaped); break;
+					}
+				}
+				else
+				{
+					result.push_back(c);
+				}
+			}
+
+			expect('"');
+			return result;
+		}
+};
+
+JsonValue JsonValue::parse(const string &source)
+{
+	JsonParser parser(source);
+	return parser.parse_value();
+}
+
+JsonValue JsonValue::parse_file(const string &location)
+{
+	ifstream input(location, ios::binary);
+	string source((istreambuf_iterator<char>(input)), (istreambuf_iterator<char>()));
+	return parse(source);
+}
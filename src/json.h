@@ -0,0 +1,28 @@
+#pragma once
+
+#include "types.h"
+
+// Minimal JSON document model, enough for reading test data files
+class JsonValue
+{
+	public:
+		enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+		Type type = NUL;
+		bool boolean = false;
+		double number = 0;
+		string text;
+		vector<JsonValue> items;
+		vector<pair<string, JsonValue>> members;
+
+		bool is_null() const { return type == NUL; }
+		int as_int() const { return (int) number; }
+
+		// Object member lookup, returns a null value when missing
+		const JsonValue& operator[](const string &key) const;
+		const JsonValue& operator[](size_t index) const;
+		size_t size() const;
+
+		static JsonValue parse(const string &source);
+		static JsonValue parse_file(const string &location);
+};
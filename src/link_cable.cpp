@@ -0,0 +1,73 @@
+#include "link_cable.h"
+
+LinkCable::LinkCable(Emulator &first, Emulator &second)
+{
+	ends[0] = &first;
+	ends[1] = &second;
+
+	clock = max(first.cycles_run, second.cycles_run);
+}
+
+void LinkCable::run_frame()
+{
+	uint64_t target = clock + (uint64_t) (ends[0]->cpu.CLOCK_SPEED / ends[0]->framerate);
+
+	while (true)
+	{
+		// Complete transfers once the other side has caught up to the transfer start
+		for (int side = 0; side < 2; side++)
+		{
+			if (waiting[side] && ends[1 - side]->cycles_run >= ends[side]->cycles_run)
+			{
+				transfer(*ends[side], *ends[1 - side]);
+				waiting[side] = false;
+			}
+		}
+
+		// Pick the side to advance, the one that's behind unless it's waiting
+		int side;
+
+		if (waiting[0])
+			side = 1;
+		else if (waiting[1])
+			side = 0;
+		else
+			side = (ends[0]->cycles_run <= ends[1]->cycles_run) ? 0 : 1;
+
+		Emulator &emulator = *ends[side];
+		Emulator &other = *ends[1 - side];
+
+		// Catch up to a waiting partner, otherwise run freely to the end of the frame
+		uint64_t limit = waiting[1 - side] ? other.cycles_run : target;
+
+		if (!waiting[1 - side] && emulator.cycles_run >= target && other.cycles_run >= target)
+			break;
+
+		if (emulator.run_until(limit))
+			waiting[side] = true;
+	}
+
+	clock = target;
+
+	ends[0]->display.scanlines_rendered = 0;
+	ends[1]->display.scanlines_rendered = 0;
+}
+
+// The master shifts its byte out while shifting in the slave's byte, the slave only
+// takes part if it has a transfer armed on the external clock
+void LinkCable::transfer(Emulator &master, Emulator &slave)
+{
+	Byte slave_control = slave.memory.SC.get();
+
+	if ((slave_control & 0x81) != 0x80 || slave.serial_counter != 0)
+		return;
+
+	Byte master_byte = master.memory.SB.get();
+	Byte slave_byte = slave.memory.SB.get();
+
+	master.serial_incoming = slave_byte;
+
+	slave.serial_counter = master.serial_counter;
+	slave.serial_incoming = master_byte;
+	slave.serial_output.push_back(slave_byte);
+}
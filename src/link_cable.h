@@ -0,0 +1,25 @@
+#pragma once
+
+#include "emulator.h"
+
+// Connects the serial ports of two emulators in the same process. Each side runs freely
+// until it starts a transfer, then waits for the other side to catch up to the same
+// cycle before the bytes are exchanged, so both only synchronize around transfers.
+class LinkCable
+{
+	public:
+
+		LinkCable(Emulator &first, Emulator &second);
+
+		// Advance both emulators by one frame
+		void run_frame();
+
+	private:
+
+		Emulator* ends[2];
+		bool waiting[2] = { false, false }; // stopped at the start of a transfer
+
+		uint64_t clock = 0; // cycle both sides have reached at the end of the last frame
+
+		void transfer(Emulator &master, Emulator &slave);
+};
@@ -1,23 +1,279 @@
 #include "emulator.h"
 #include "cpu.h"
 #include "display.h"
+#include "validator.h"
+#include "sm83_tests.h"
+#include "test_roms.h"
+#include "self_tests.h"
+#include "net_link.h"
+#include "input_search.h"
+#include "movie.h"
+#include "heatmap.h"
+#include "benchmark.h"
+#include "coverage.h"
+#include "rom_library.h"
+
+#include <iomanip>
+#include <sstream>
 
 int main(int argc, char *args[])
 {
+	vector<string> arguments(args + 1, args + argc);
+
+	// Run the block decoding core against the reference interpreter
+	// usage: --validate <rom> [instructions] [interval]
+	if (arguments.size() >= 2 && arguments[0] == "--validate")
+	{
+		Validator validator(arguments[1]);
+		long instructions = (arguments.size() >= 3) ? stol(arguments[2]) : 10000000;
+
+		if (arguments.size() >= 4)
+			validator.interval = stoi(arguments[3]);
+
+		return validator.run(instructions) ? 0 : 1;
+	}
+
+	// Single step CPU conformance tests, one JSON file per opcode
+	// usage: --sm83-tests <directory>
+	if (arguments.size() >= 2 && arguments[0] == "--sm83-tests")
+	{
+		ConformanceRunner runner;
+		return (runner.run(arguments[1]) == 0) ? 0 : 1;
+	}
+
+	// Headless test ROM runs, judged by serial output or memory signatures
+	// usage: --test-roms <directory>
+	if (arguments.size() >= 2 && arguments[0] == "--test-roms")
+	{
+		TestRomRunner runner;
+		return (runner.run(arguments[1]) == 0) ? 0 : 1;
+	}
+
+	// Built-in checks of the CPU core and hardware timing
+	// usage: --self-tests
+	if (arguments.size() >= 1 && arguments[0] == "--self-tests")
+	{
+		SelfTests tests;
+		return (tests.run() == 0) ? 0 : 1;
+	}
+
+	// Search for inputs that get a byte of memory to a value
+	// usage: --search <rom> <address> <value> [frames] [save state]
+	if (arguments.size() >= 4 && arguments[0] == "--search")
+	{
+		InputSearch search(arguments[1]);
+		Address address = (Address) stoi(arguments[2], nullptr, 16);
+		Byte value = (Byte) stoi(arguments[3], nullptr, 16);
+
+		if (arguments.size() >= 5)
+			search.max_frames = stoi(arguments[4]);
+
+		string start_state;
+		if (arguments.size() >= 6)
+		{
+			ifstream file(arguments[5], ios::binary);
+			start_state.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+		}
+
+		search.goal = [=](Emulator &emulator) { return emulator.memory.peek(address) == value; };
+		search.score = [=](Emulator &emulator) { return -abs(emulator.memory.peek(address) - value); };
+
+		bool found = search.run(start_state);
+
+		cout << (found ? "Found" : "Not found") << " after " << search.expanded << " frames run ("
+			<< search.duplicates << " duplicate states, " << search.lag_skipped << " skipped on lag frames)" << endl;
+
+		for (Byte input : search.solution)
+			cout << hex << setw(2) << setfill('0') << (int) input << " ";
+		cout << dec << endl;
+
+		return found ? 0 : 1;
+	}
+
+	// Play back a movie and keep recording once it ends, saved when the window closes
+	// usage: --movie <rom> <movie file> [keyframe interval] [start frame]
+	if (arguments.size() >= 3 && arguments[0] == "--movie")
+	{
+		Emulator emulator;
+		Movie movie;
+
+		emulator.load_rom(arguments[1]);
+		movie.load(arguments[2]);
+
+		if (arguments.size() >= 4)
+			movie.keyframe_interval = stoi(arguments[3]);
+
+		if (arguments.size() >= 5)
+			movie.seek(emulator, stoul(arguments[4]));
+
+		emulator.movie = &movie;
+		emulator.run();
+
+		return movie.save(arguments[2]) ? 0 : 1;
+	}
+
+	// Replay every stretch between two keyframes of a movie in parallel
+	// usage: --verify-movie <rom> <movie file>
+	if (arguments.size() >= 3 && arguments[0] == "--verify-movie")
+	{
+		Movie movie;
+
+		if (!movie.load(arguments[2]))
+			return 1;
+
+		int failed = movie.verify(arguments[1]);
+		cout << (failed == 0 ? "Movie verified, " : "Movie desynced, ") << movie.inputs.size() << " frames" << endl;
+
+		return (failed == 0) ? 0 : 1;
+	}
+
+	// Emulation speed and host performance counters per frame
+	// usage: --benchmark <rom> [seconds]
+	if (arguments.size() >= 2 && arguments[0] == "--benchmark")
+	{
+		Benchmark benchmark;
+
+		if (arguments.size() >= 3)
+			benchmark.seconds = stod(arguments[2]);
+
+		benchmark.run(arguments[1]);
+		return 0;
+	}
+
+	// Merged opcode histogram over every ROM in a directory
+	// usage: --coverage <directory> [seconds per ROM] [report file]
+	if (arguments.size() >= 2 && arguments[0] == "--coverage")
+	{
+		CoverageRunner runner;
+
+		if (arguments.size() >= 3)
+			runner.seconds = stod(arguments[2]);
+
+		OpcodeCoverage coverage = runner.run(arguments[1]);
+
+		if (arguments.size() >= 4)
+		{
+			ofstream report(arguments[3]);
+			coverage.report(report);
+		}
+		else
+			coverage.report(cout);
+
+		return 0;
+	}
+
+	// Index every ROM under a directory by header, checksums and content hash
+	// usage: --index <directory> <index file>
+	if (arguments.size() >= 3 && arguments[0] == "--index")
+	{
+		int indexed = RomLibrary::build(arguments[1], arguments[2]);
+
+		if (indexed < 0)
+		{
+			cout << "Could not write " << arguments[2] << endl;
+			return 1;
+		}
+
+		cout << "Indexed " << indexed << " ROMs" << endl;
+		return 0;
+	}
+
+	// Look up ROMs in an index, or play the first match
+	// usage: --find <index file> <title or hash> or --launch <index file> <title or hash>
+	if (arguments.size() >= 3 && (arguments[0] == "--find" || arguments[0] == "--launch"))
+	{
+		RomLibrary library;
+
+		if (!library.open(arguments[1]))
+		{
+			cout << "Could not open index " << arguments[1] << endl;
+			return 1;
+		}
+
+		vector<const RomRecord*> matches = library.find(arguments[2]);
+
+		if (matches.empty())
+		{
+			cout << "No ROM matches " << arguments[2] << endl;
+			return 1;
+		}
+
+		if (arguments[0] == "--launch")
+		{
+			Emulator emulator;
+			emulator.load_rom(library.get_path(*matches[0]));
+			emulator.run();
+			return 0;
+		}
+
+		for (const RomRecord* rom : matches)
+		{
+			cout << hex << setfill('0') << setw(16) << rom->content_hash << dec << setfill(' ')
+				<< " " << rom->get_title()
+				<< ((rom->cgb_flag & 0x80) ? " CGB" : "") << ((rom->sgb_flag == 0x03) ? " SGB" : "")
+				<< " cart " << (int) rom->cart_type
+				<< (rom->checksums_valid & RomRecord::HEADER_VALID ? "" : " bad header checksum")
+				<< (rom->checksums_valid & RomRecord::GLOBAL_VALID ? "" : " bad global checksum")
+				<< " " << library.get_path(*rom) << endl;
+		}
+
+		return 0;
+	}
+
+	// Count memory accesses over a headless run
+	// usage: --heatmap <rom> <seconds> <output prefix>
+	if (arguments.size() >= 4 && arguments[0] == "--heatmap")
+	{
+		Emulator emulator(true);
+		emulator.load_rom(arguments[1], false);
+
+		AccessHeatmap heatmap(emulator.memory.get_rom_size());
+		emulator.memory.heatmap = &heatmap;
+
+		int frames = (int) (stod(arguments[2]) * 60);
+		for (int i = 0; i < frames && emulator.stop_reason == StopReason::NONE; i++)
+			emulator.run_frame();
+
+		emulator.memory.heatmap = nullptr;
+
+		bool saved = heatmap.save(arguments[3] + ".bin") && heatmap.save_png(arguments[3]);
+		return saved ? 0 : 1;
+	}
+
+	// Link cable play against another process
+	// usage: --link-host <rom> <port> or --link-connect <rom> <address> <port>
+	if (arguments.size() >= 3 && (arguments[0] == "--link-host" || arguments[0] == "--link-connect"))
+	{
+		Emulator emulator;
+		NetLink link(emulator);
+
+		emulator.load_rom(arguments[1]);
+
+		bool connected = (arguments[0] == "--link-host")
+			? link.host((unsigned short) stoi(arguments[2]))
+			: (arguments.size() >= 4 && link.connect(arguments[2], (unsigned short) stoi(arguments[3])));
+
+		if (!connected)
+		{
+			cout << "Could not establish link connection" << endl;
+			return 1;
+		}
+
+		emulator.net_link = &link;
+		emulator.run();
+		return 0;
+	}
+
 	Emulator emulator;
 
-	//string name = "cpu/cpu_instrs";
-	//string name = "instr_timing";
-
-	//emulator.memory.load_rom("tests/" + name + ".gb");
-	//emulator.memory.load_rom("roms/Dr. Mario.gb");
-	//emulator.memory.load_rom("roms/kirby.gb");
-	//emulator.memory.load_rom("roms/tetris.gb");
-	//emulator.memory.load_rom("roms/minesweeper.gb");
-	//emulator.memory.load_rom("roms/Super Mario Land.gb");
-	//emulator.memory.load_rom("roms/cASTELIAN.gb");
-	//emulator.memory.load_rom("roms/Serpent.gb");
-	emulator.memory.load_rom("roms/yupferris.gb");
+	//emulator.load_rom("roms/Dr. Mario.gb");
+	//emulator.load_rom("roms/kirby.gb");
+	//emulator.load_rom("roms/tetris.gb");
+	//emulator.load_rom("roms/minesweeper.gb");
+	//emulator.load_rom("roms/Super Mario Land.gb");
+	//emulator.load_rom("roms/cASTELIAN.gb");
+	//emulator.load_rom("roms/Serpent.gb");
+	emulator.load_rom("roms/yupferris.gb");
 
 	emulator.run();
 
@@ -1,14 +1,20 @@
 #include "memory.h"
+#include "heatmap.h"
+#include "apu.h"
+
+#include <sstream>
 
 Memory::Memory()
 {
-	WRAM = vector<Byte>(0x2000); // $C000 - $DFFF, 8kB Working RAM
+	WRAM = vector<Byte>(0x8000); // $C000 - $DFFF, 8kB Working RAM, 32kB banked on CGB
 	ZRAM = vector<Byte>(0x0100); // $FF00 - $FFFF, 256 bytes of RAM
-	VRAM = vector<Byte>(0x2000); // $8000 - $9FFF, 8kB Video RAM
+	VRAM = vector<Byte>(0x4000); // $8000 - $9FFF, 8kB Video RAM, 16kB banked on CGB
 	OAM  = vector<Byte>(0x0100); // $FE00 - $FEFF, OAM Sprite RAM, IO RAM
 
 	// Initialize Memory Register objects for easy reference
 	P1   = MemoryRegister(&ZRAM[0x00]);
+	SB   = MemoryRegister(&ZRAM[0x01]);
+	SC   = MemoryRegister(&ZRAM[0x02]);
 	DIV  = MemoryRegister(&ZRAM[0x04]);
 	TIMA = MemoryRegister(&ZRAM[0x05]);
 	TMA  = MemoryRegister(&ZRAM[0x06]);
@@ -40,6 +46,8 @@ void Memory::reset()
 
 	// The following memory locations are set to the following values after gameboy BIOS runs
 	P1.set(0x00);
+	SB.set(0x00);
+	SC.set(0x7E);
 	DIV.set(0x00);
 	TIMA.set(0x00);
 	TMA.set(0x00);
@@ -59,14 +67,25 @@ void Memory::reset()
 	// Initialize input to HIGH state (unpressed)
 	joypad_buttons = 0xF;
 	joypad_arrows  = 0xF;
+
+	palettes.reset();
+	fill(&tile_dirty[0][0], &tile_dirty[0][0] + sizeof(tile_dirty), true);
+
+	update_pages();
 }
 
-void Memory::load_rom(std::string location)
+void Memory::load_rom(std::string location, bool print_info)
 {
 	ifstream input(location, ios::binary);
 	vector<Byte> buffer((istreambuf_iterator<char>(input)), (istreambuf_iterator<char>()));
 
+	load_rom(buffer, print_info);
+}
+
+void Memory::load_rom(const vector<Byte> &buffer, bool print_info)
+{
 	// print cartrige data
+	stringstream info;
 	string title = "";
 
 	for (int i = 0x0134; i <= 0x142; i++)
@@ -80,11 +99,21 @@ void Memory::load_rom(std::string location)
 
 	rom_name = title;
 
-	cout << "Title: " << title << endl;
+	info << "Title: " << title << endl;
 	Byte gb_type = buffer[0x0143];
-	cout << "Gameboy Type: " << ((gb_type == 0x80) ? "GB Color" : "GB") << endl;
+	info << "Gameboy Type: " << ((gb_type == 0x80) ? "GB Color" : (gb_type == 0xC0) ? "GB Color only" : "GB") << endl;
+
+	// 0x80 runs on both, 0xC0 on CGB only
+	cgb = (gb_type & 0x80) != 0;
+	ZRAM[0x4F] = cgb ? 0xFE : 0x00;
+	ZRAM[0x70] = cgb ? 0xF8 : 0x00;
+	ZRAM[0x55] = 0xFF;
+	ZRAM[0x4D] = cgb ? 0x7E : 0x00;
+	speed_shift = 0;
+	hdma_active = false;
+	update_pages();
 	Byte functions = buffer[0x0146];
-	cout << "Use " << ((functions == 0x3) ? "Super " : "") << "Gameboy functions" << endl;
+	info << "Use " << ((functions == 0x3) ? "Super " : "") << "Gameboy functions" << endl;
 
 	string cart_types[0x100];
 	cart_types[0x0] = "ROM ONLY";
@@ -115,7 +144,7 @@ void Memory::load_rom(std::string location)
 	cart_types[0xFF] = "Hudson HuC-1";
 
 	Byte cart = buffer[0x0147];
-	cout << "Cartridge Type: " << cart_types[cart] << endl;
+	info << "Cartridge Type: " << cart_types[cart] << endl;
 
 	delete controller;
 
@@ -129,7 +158,7 @@ void Memory::load_rom(std::string location)
 			break;
 		case 0x05:
 		case 0x06:
-			cout << "CONTROLLER NOT IMPLEMENTED" << endl;
+			info << "CONTROLLER NOT IMPLEMENTED" << endl;
 			controller = new MemoryController2();
 			break;
 		case 0x0F:
@@ -148,7 +177,7 @@ void Memory::load_rom(std::string location)
 	controller->init(buffer);
 
 	Byte rsize = buffer[0x0148];
-	cout << "ROM Size: " << (32 << rsize) << "kB " << pow(2, rsize + 1) << " banks" << endl;
+	info << "ROM Size: " << (32 << rsize) << "kB " << pow(2, rsize + 1) << " banks" << endl;
 	int size, banks;
 	switch (buffer[0x149])
 	{
@@ -158,11 +187,29 @@ void Memory::load_rom(std::string location)
 		case 4: size = 128; banks = 16;
 		default: size = 0; banks = 0;
 	}
-	cout << "RAM Size: " << size << "kB " << banks << " banks" << endl;
-	cout << "Destination Code: " << (buffer[0x014A] == 1 ? "Non-" : "") << "Japanese" << endl;
+	info << "RAM Size: " << size << "kB " << banks << " banks" << endl;
+	info << "Destination Code: " << (buffer[0x014A] == 1 ? "Non-" : "") << "Japanese" << endl;
+
+	if (print_info)
+		cout << info.str();
 }
 
-void Memory::save_state(ofstream &file)
+void Memory::load_flat()
+{
+	delete controller;
+	controller = new FlatController();
+	controller->init(vector<Byte>(0x8000));
+
+	cgb = false;
+	plain_io = true;
+	update_pages();
+
+	// Echo RAM gets the otherwise unused CGB banks, so it's memory of its own
+	pages[0xE] = &WRAM[0x2000];
+	pages[0xF] = &WRAM[0x3000];
+}
+
+void Memory::save_state(ostream &file)
 {
 	write_vector(file, VRAM);
 	write_vector(file, OAM);
@@ -173,14 +220,19 @@ void Memory::save_state(ofstream &file)
 	vector<Byte> eram = controller->get_ram();
 	write_vector(file, eram);
 	controller->save_state(file);
+
+	palettes.save_state(file);
 }
 
-void Memory::load_state(ifstream &file)
+void Memory::load_state(istream &file)
 {
 	load_vector(file, VRAM);
 	load_vector(file, OAM);
 	load_vector(file, WRAM);
 	load_vector(file, ZRAM);
+	update_pages();
+	hdma_active = cgb && !(ZRAM[0x55] & 0x80);
+	speed_shift = (cgb && (ZRAM[0x4D] & 0x80)) ? 1 : 0;
 
 	// Load ERAM
 	vector<Byte> eram(0x8000);
@@ -188,14 +240,31 @@ void Memory::load_state(ifstream &file)
 	load_vector(file, eram);
 	controller->set_ram(eram);
 	controller->load_state(file);
+
+	palettes.load_state(file);
+	fill(&tile_dirty[0][0], &tile_dirty[0][0] + sizeof(tile_dirty), true);
+}
+
+// Hash of all RAM regions, used to compare two emulator instances
+uint64_t Memory::hash()
+{
+	vector<Byte> eram = controller->get_ram();
+
+	uint64_t result = hash_bytes(&VRAM[0], VRAM.size());
+	result = hash_bytes(&OAM[0], OAM.size(), result);
+	result = hash_bytes(&WRAM[0], WRAM.size(), result);
+	result = hash_bytes(&ZRAM[0], ZRAM.size(), result);
+	result = hash_bytes(&eram[0], eram.size(), result);
+
+	return result;
 }
 
-void Memory::write_vector(ofstream &file, vector<Byte> &vec)
+void Memory::write_vector(ostream &file, vector<Byte> &vec)
 {
 	file.write((char*)&vec[0], vec.size());
 }
 
-void Memory::load_vector(ifstream &file, vector<Byte> &vec)
+void Memory::load_vector(istream &file, vector<Byte> &vec)
 {
 	file.read((char*)&vec[0], vec.size());
 }
@@ -204,10 +273,162 @@ void Memory::do_dma_transfer()
 {
 	Byte_2 address = DMA.get() << 8; // multiply by 100
 
-	for (int i = 0; i < 0xA0; i++)
+	copy_block(address, 0xFE00, &OAM[0], 0xA0);
+}
+
+// Start a CGB VRAM DMA from HDMA1-4. With bit 7 set it copies 16 bytes every HBlank,
+// otherwise it copies everything now and holds the CPU until it's done. Writing with
+// bit 7 clear during an HBlank DMA stops it instead.
+void Memory::start_vram_dma(Byte control)
+{
+	int blocks = (control & 0x7F) + 1;
+
+	if (hdma_active && !(control & 0x80))
+	{
+		hdma_active = false;
+		ZRAM[0x55] |= 0x80;
+		return;
+	}
+
+	if (control & 0x80)
 	{
-		write((0xFE00 + i), read(address + i));
+		hdma_active = true;
+		ZRAM[0x55] = (Byte) (blocks - 1);
+		return;
 	}
+
+	for (int i = 0; i < blocks; i++)
+		copy_vram_block();
+
+	ZRAM[0x55] = 0xFF;
+}
+
+// Copy 16 bytes and advance HDMA1-4, which keep the addresses between transfers.
+// Takes 32 clock cycles of the CPU
+void Memory::copy_vram_block()
+{
+	Address source = ((ZRAM[0x51] << 8) | ZRAM[0x52]) & 0xFFF0;
+	Address destination = ((ZRAM[0x53] << 8) | ZRAM[0x54]) & 0x1FF0;
+
+	copy_block(source, 0x8000 | destination, &pages[0x8 + (destination >> 12)][destination & 0x0FF0], 0x10);
+	dirty_tiles[destination >> 4] = true;
+	stall_cycles += 32;
+
+	source += 0x10;
+	destination = (destination + 0x10) & 0x1FF0;
+
+	ZRAM[0x51] = source >> 8;
+	ZRAM[0x52] = source & 0xFF;
+	ZRAM[0x53] = destination >> 8;
+	ZRAM[0x54] = destination & 0xFF;
+
+	if (hdma_active)
+	{
+		Byte remaining = ZRAM[0x55] & 0x7F;
+		ZRAM[0x55] = remaining ? remaining - 1 : 0xFF;
+		hdma_active = (remaining != 0);
+	}
+}
+
+// Both DMAs copy whole blocks that don't cross a 256 byte page, so the source is
+// looked up once. Sources without plain memory behind them fall back to fetch().
+// The copied bytes are logged and counted like the CPU's own reads and writes
+void Memory::copy_block(Address source, Address destination, Byte* target, int length)
+{
+	const Byte* page = source_page(source);
+
+	if (page)
+		copy(page, page + length, target);
+	else
+	{
+		for (int i = 0; i < length; i++)
+			target[i] = fetch(source + i);
+	}
+
+	if (!write_log && !heatmap)
+		return;
+
+	for (int i = 0; i < length; i++)
+	{
+		if (write_log)
+			write_log->log(destination + i, target[i]);
+
+		if (heatmap)
+		{
+			heatmap->count(AccessHeatmap::READ, source + i, get_rom_bank(), get_ram_bank());
+			heatmap->count(AccessHeatmap::WRITE, destination + i, get_rom_bank(), get_ram_bank());
+		}
+	}
+}
+
+const Byte* Memory::source_page(Address location)
+{
+	if (location <= 0x7FFF || (location >= 0xA000 && location <= 0xBFFF))
+		return controller->direct_pointer(location);
+
+	return direct_pointer(location);
+}
+
+Byte Memory::get_rom_bank()
+{
+	return controller->get_rom_bank();
+}
+
+Byte Memory::get_ram_bank()
+{
+	return controller->get_ram_bank();
+}
+
+size_t Memory::get_rom_size()
+{
+	return controller->get_rom_size();
+}
+
+// KEY1 bit 7 holds the current speed, bit 0 is set by the game to ask for a switch
+// on the next STOP. The switch itself holds the CPU for 8200 clock cycles
+bool Memory::switch_speed()
+{
+	if (!cgb || !(ZRAM[0x4D] & 0x01))
+		return false;
+
+	ZRAM[0x4D] = ((ZRAM[0x4D] ^ 0x80) & 0x80) | 0x7E;
+	speed_shift = (ZRAM[0x4D] & 0x80) ? 1 : 0;
+	stall_cycles += 8200;
+	return true;
+}
+
+// VBK, bank 0 outside of CGB mode
+Byte Memory::get_vram_bank()
+{
+	return cgb ? (ZRAM[0x4F] & 0x01) : 0;
+}
+
+// SVBK, bank 0 selects bank 1 as well
+Byte Memory::get_wram_bank()
+{
+	Byte bank = cgb ? (ZRAM[0x70] & 0x07) : 1;
+	return bank ? bank : 1;
+}
+
+Byte* Memory::vram_bank(int bank)
+{
+	return &VRAM[bank * 0x2000];
+}
+
+void Memory::update_pages()
+{
+	Byte* vram = &VRAM[get_vram_bank() * 0x2000];
+	Byte* wram = &WRAM[get_wram_bank() * 0x1000];
+
+	pages[0x8] = vram;
+	pages[0x9] = vram + 0x1000;
+	dirty_tiles = tile_dirty[get_vram_bank()];
+	pages[0xC] = &WRAM[0];
+	pages[0xD] = wram;
+
+	// Echo RAM
+	pages[0xE] = &WRAM[0];
+	pages[0xF] = wram;
 }
 
 Byte Memory::get_joypad_state()
@@ -225,9 +446,28 @@ Byte Memory::get_joypad_state()
 	}
 }
 
+Byte* Memory::direct_pointer(Address location)
+{
+	if ((location >= 0x8000 && location <= 0x9FFF) || (location >= 0xC000 && location <= 0xFDFF))
+		return &pages[location >> 12][location & 0x0FFF];
+	if (location >= 0xFE00 && location <= 0xFEFF)
+		return &OAM[location & 0xFF];
+	if (location >= 0xFF01)
+		return &ZRAM[location & 0xFF];
+
+	return nullptr;
+}
+
 Byte Memory::read(Address location)
 {
-	
+	if (heatmap)
+		heatmap->count(AccessHeatmap::READ, location, get_rom_bank(), get_ram_bank());
+
+	return fetch(location);
+}
+
+Byte Memory::fetch(Address location)
+{
 	switch (location & 0xF000)
 	{
 	// ROM
@@ -244,7 +484,7 @@ Byte Memory::read(Address location)
 	// Graphics VRAM
 	case 0x8000:
 	case 0x9000:
-		return VRAM[location & 0x1FFF];
+		return pages[location >> 12][location & 0x0FFF];
 
 	// External RAM
 	case 0xA000:
@@ -255,7 +495,7 @@ Byte Memory::read(Address location)
 	case 0xC000:
 	case 0xD000:
 	case 0xE000:
-		return WRAM[location & 0x1FFF];
+		return pages[location >> 12][location & 0x0FFF];
 
 	// Remaining Working RAM Shadow, I/O, Zero page RAM
 	case 0xF000:
@@ -266,15 +506,18 @@ Byte Memory::read(Address location)
 			case 0x400: case 0x500: case 0x600: case 0x700:
 			case 0x800: case 0x900: case 0xA00: case 0xB00:
 			case 0xC00: case 0xD00:
-				return WRAM[location & 0x1FFF];
+				return pages[0xF][location & 0x0FFF];
 
 			// Sprite OAM
 			case 0xE00:
 					return OAM[location & 0xFF];
 
 			case 0xF00:
-				if (location == 0xFF00)
+				if (location == 0xFF00 && !plain_io)
+				{
+					joypad_reads++;
 					return get_joypad_state();
+				}
 				else
 					return ZRAM[location & 0xFF];
 		}
@@ -283,8 +526,22 @@ Byte Memory::read(Address location)
 	}
 }
 
+Byte Memory::peek(Address location)
+{
+	if (location == 0xFF00 && !plain_io)
+		return get_joypad_state();
+
+	return fetch(location);
+}
+
 void Memory::write(Address location, Byte data)
 {
+	if (write_log)
+		write_log->log(location, data);
+
+	if (heatmap)
+		heatmap->count(AccessHeatmap::WRITE, location, get_rom_bank(), get_ram_bank());
+
 	switch (location & 0xF000)
 	{
 	// ROM
@@ -303,7 +560,8 @@ void Memory::write(Address location, Byte data)
 	case 0x8000:
 	case 0x9000:
 		// Cannot write to VRAM during mode 3 
-		VRAM[location & 0x1FFF] = data;
+		pages[location >> 12][location & 0x0FFF] = data;
+		dirty_tiles[(location & 0x1FFF) >> 4] = true;
 		break;
 
 	// External RAM
@@ -316,7 +574,7 @@ void Memory::write(Address location, Byte data)
 	case 0xC000:
 	case 0xD000:
 	case 0xE000:
-		WRAM[location & 0x1FFF] = data;
+		pages[location >> 12][location & 0x0FFF] = data;
 		break;
 
 	// Remaining Working RAM Shadow, I/O, Zero page RAM
@@ -328,7 +586,7 @@ void Memory::write(Address location, Byte data)
 		case 0x400: case 0x500: case 0x600: case 0x700:
 		case 0x800: case 0x900: case 0xA00: case 0xB00:
 		case 0xC00: case 0xD00:
-			WRAM[location & 0x1FFF] = data;
+			pages[0xF][location & 0x0FFF] = data;
 			break;
 
 		// Sprite OAM
@@ -345,6 +603,15 @@ void Memory::write(Address location, Byte data)
 
 void Memory::write_zero_page(Address location, Byte data)
 {
+	if (plain_io)
+	{
+		ZRAM[location & 0xFF] = data;
+		return;
+	}
+
+	if (apu_writes && location >= 0xFF10 && location <= 0xFF3F)
+		apu_writes->push(location, data);
+
 	switch (location)
 	{
 	// Joypad Register - only bits 4 & 5 can be written to
@@ -369,6 +636,49 @@ void Memory::write_zero_page(Address location, Byte data)
 		ZRAM[0x46] = data;
 		do_dma_transfer();
 		break;
+	// KEY1 - CGB speed switch, only the prepare bit can be written
+	case 0xFF4D:
+		ZRAM[0x4D] = cgb ? ((ZRAM[0x4D] & 0x80) | 0x7E | (data & 0x01)) : data;
+		break;
+	// VBK - CGB VRAM bank, unused bits read as 1
+	case 0xFF4F:
+		ZRAM[0x4F] = cgb ? (0xFE | data) : data;
+		update_pages();
+		break;
+	// HDMA5 - CGB VRAM DMA length, mode and start
+	case 0xFF55:
+		if (cgb)
+			start_vram_dma(data);
+		else
+			ZRAM[0x55] = data;
+		break;
+	// BCPS/BCPD and OCPS/OCPD - CGB palette index and data. ZRAM mirrors what
+	// they read back as
+	case 0xFF68:
+	case 0xFF69:
+	case 0xFF6A:
+	case 0xFF6B:
+		if (cgb)
+		{
+			int set = (location >= 0xFF6A) ? CgbPalettes::SPRITES : CgbPalettes::BACKGROUND;
+			Byte index_register = (set == CgbPalettes::SPRITES) ? 0x6A : 0x68;
+
+			if (location & 0x01)
+				palettes.write_data(set, data);
+			else
+				palettes.write_index(set, data);
+
+			ZRAM[index_register] = palettes.read_index(set);
+			ZRAM[index_register + 1] = palettes.read_data(set);
+		}
+		else
+			ZRAM[location & 0xFF] = data;
+		break;
+	// SVBK - CGB WRAM bank at $D000
+	case 0xFF70:
+		ZRAM[0x70] = cgb ? (0xF8 | data) : data;
+		update_pages();
+		break;
 	default:
 		ZRAM[location & 0xFF] = data;
 		break;
@@ -2,27 +2,53 @@
 
 #include "types.h"
 #include "memory_controllers.h"
+#include "write_log.h"
+#include "cgb_palettes.h"
+
+class AccessHeatmap;
+class ApuWriteQueue;
 
 class Memory
 {
 	private:
 
 		// Dynamic Memory Controller
-		MemoryController* controller;
+		MemoryController* controller = nullptr;
 
 		// Memory Regions
-		vector<Byte> VRAM;		// $8000 - $9FFF, 8kB Video RAM
+		vector<Byte> VRAM;		// $8000 - $9FFF, 8kB Video RAM, 2 banks on CGB
 		vector<Byte> OAM;		// $FE00 - $FEA0, OAM Sprite RAM
-		vector<Byte> WRAM;		// $C000 - $DFFF, 8kB Working RAM
+		vector<Byte> WRAM;		// $C000 - $DFFF, 8kB Working RAM, 8 4kB banks on CGB
 		vector<Byte> ZRAM;		// $FF80 - $FFFF, 128 bytes of RAM
 
+		// VRAM and WRAM by 4kB page of the address space, pointing into the selected
+		// banks. Bank switches repoint them so accesses never look at VBK or SVBK
+		Byte* pages[0x10];
+		void update_pages();
+
+		// tile_dirty row of the selected VRAM bank
+		bool* dirty_tiles;
+
 		void do_dma_transfer();
 		Byte get_joypad_state();
 
+		// Set by load_flat(), I/O writes only store the value and P1 reads back as written
+		bool plain_io = false;
+
+		// -------- CGB VRAM DMA -------- //
+		bool hdma_active = false; // HBlank DMA has blocks left, FF55 bit 7 clear
+		void start_vram_dma(Byte control);
+		void copy_vram_block();
+
+		// Copy from any readable address to the memory behind destination, resolving the
+		// source page once
+		void copy_block(Address source, Address destination, Byte* target, int length);
+		const Byte* source_page(Address location);
+
 	public:
 
 		MemoryRegister
-			P1,
+			P1, SB, SC,
 			DIV, TIMA, TMA, TAC,
 			LCDC, STAT, SCY, SCX, LYC, LY, DMA,
 			BGP, OBP0, OBP1, WY, WX,
@@ -32,18 +58,88 @@ class Memory
 		Byte joypad_buttons;
 		Byte joypad_arrows;
 
+		// Times P1 has been read, tells whether the game is polling input
+		uint64_t joypad_reads = 0;
+
 		string rom_name;
 
+		// Cartridge supports the Game Boy Color, enables VRAM and WRAM banking
+		bool cgb = false;
+
+		// CGB colour palettes, written through 0xFF68 - 0xFF6B
+		CgbPalettes palettes;
+
+		// Set for each 16 byte tile of a VRAM bank when it's written, the display clears
+		// them as it decodes tiles again. Map rows are flagged too but never read
+		bool tile_dirty[2][0x200];
+
+		// 8kB of a VRAM bank, whichever bank VBK selects
+		Byte* vram_bank(int bank);
+
+		// Every write is logged here when set, see Emulator::attach_write_log()
+		WriteLog* write_log = nullptr;
+
+		// 1 in CGB double speed, CPU cycles are shifted right by it to get clock cycles.
+		// Only changes on a speed switch
+		int speed_shift = 0;
+
+		// STOP with KEY1 bit 0 set, returns true if the speed was switched
+		bool switch_speed();
+
+		// Clock cycles the CPU was held up by DMA since the last step, Emulator::step()
+		// charges them to the instruction and clears them
+		int stall_cycles = 0;
+
+		// Called on entering HBlank, copies the next 16 bytes of an HBlank DMA
+		void hblank()
+		{
+			if (hdma_active)
+				copy_vram_block();
+		}
+
+		// Reads and writes are counted here when set
+		AccessHeatmap* heatmap = nullptr;
+
+		// Sound register writes are queued here for the audio thread when set, see
+		// Emulator::attach_audio(). Headless runs leave it unset and the writes only
+		// land in ZRAM
+		ApuWriteQueue* apu_writes = nullptr;
+
 		Memory::Memory();
 		void reset();
-		void load_rom(std::string location);
+		void load_rom(std::string location, bool print_info = true);
+		void load_rom(const vector<Byte> &buffer, bool print_info = true);
+
+		// Flat 64kB address space for CPU tests: the cartridge reads and writes like RAM,
+		// echo RAM is separate memory and I/O registers have no side effects
+		void load_flat();
 
 		Byte read(Address location);
 
-		void write_vector(ofstream &file, vector<Byte> &vec);
-		void load_vector(ifstream &file, vector<Byte> &vec);
-		void save_state(ofstream &file);
-		void load_state(ifstream &file);
+		// read() without counting in the heatmap, for opcode and operand fetches, which
+		// the heatmap counts as executes, and for looking ahead at code
+		Byte fetch(Address location);
+
+		// What the CPU would read, without any side effect on the machine or the tools
+		// watching it: not counted in the heatmap, and a P1 read isn't joypad polling.
+		// For the host looking at memory, like features, rewards and search goals
+		Byte peek(Address location);
+
+		Byte get_rom_bank();
+		Byte get_ram_bank();
+		Byte get_vram_bank();
+		Byte get_wram_bank();
+		size_t get_rom_size();
+
+		// Plain RAM behind an address for bulk reads, valid up to the end of its 256 byte
+		// page. nullptr for the cartridge and P1, which have to go through read() or peek()
+		Byte* direct_pointer(Address location);
+
+		void write_vector(ostream &file, vector<Byte> &vec);
+		void load_vector(istream &file, vector<Byte> &vec);
+		void save_state(ostream &file);
+		void load_state(istream &file);
+		uint64_t hash();
 
 		void write(Address location, Byte data);
 		void write_zero_page(Address location, Byte data);
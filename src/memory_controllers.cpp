@@ -16,13 +16,40 @@ void MemoryController::set_ram(vector<Byte> data)
 	ERAM = data;
 }
 
-void MemoryController::save_state(ofstream &file) {
-	cout << "did nothing" << endl;
+Byte MemoryController::get_rom_bank()
+{
+	return ROM_bank_id;
 }
-void MemoryController::load_state(ifstream &file) {
-	cout << "did nothing" << endl;
+
+Byte MemoryController::get_ram_bank()
+{
+	return RAM_bank_id;
 }
 
+size_t MemoryController::get_rom_size()
+{
+	return CART_ROM.size();
+}
+
+Byte* MemoryController::direct_pointer(Address location)
+{
+	size_t offset;
+
+	if (location <= 0x3FFF)
+		offset = location;
+	else if (location <= 0x7FFF)
+		offset = (ROM_bank_id * 0x4000) + (location - 0x4000);
+	else if (location >= 0xA000 && location <= 0xBFFF && RAM_access_enabled)
+		return &ERAM[(get_ram_bank() * 0x2000) + (location - 0xA000)];
+	else
+		return nullptr;
+
+	return (offset < CART_ROM.size()) ? &CART_ROM[offset] : nullptr;
+}
+
+void MemoryController::save_state(ostream &) {}
+void MemoryController::load_state(istream &) {}
+
 /*
 	MC0 represents games that use exactly 32kB of space
 	and don't have memory controllers
@@ -37,6 +64,16 @@ Byte MemoryController0::read(Address location)
 		return 0x00;
 }
 
+Byte* MemoryController0::direct_pointer(Address location)
+{
+	if (location <= 0x7FFF && location < CART_ROM.size())
+		return &CART_ROM[location];
+	else if (location >= 0xA000 && location <= 0xBFFF)
+		return &ERAM[location & 0x1FFF];
+	else
+		return nullptr;
+}
+
 void MemoryController0::write(Address location, Byte data)
 {
 	if (location >= 0xA000 && location <= 0xBFFF)
@@ -46,6 +83,12 @@ void MemoryController0::write(Address location, Byte data)
 /*
 	Memory Controller 1
 */
+// Only RAM bank 0 can be used during ROM mode
+Byte MemoryController1::get_ram_bank()
+{
+	return (RAM_bank_enabled) ? RAM_bank_id : 0x00;
+}
+
 Byte MemoryController1::read(Address location)
 {
 	// ROM bank 0 (read only)
@@ -154,25 +197,38 @@ void MemoryController1::write(Address location, Byte data)
 	}
 }
 
-void MemoryController1::save_state(ofstream &file)
+void MemoryController1::save_state(ostream &file)
 {
 	file.write((char*)&ROM_bank_id, sizeof(ROM_bank_id));
 	file.write((char*)&RAM_bank_id, sizeof(RAM_bank_id));
 	file.write((char*)&RAM_bank_enabled, sizeof(RAM_bank_enabled));
 	file.write((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
 	file.write((char*)&mode, sizeof(mode));
-
-	cout << "wrote registers" << endl;
 }
 
-void MemoryController1::load_state(ifstream &file)
+void MemoryController1::load_state(istream &file)
 {
 	file.read((char*)&ROM_bank_id, sizeof(ROM_bank_id));
 	file.read((char*)&RAM_bank_id, sizeof(RAM_bank_id));
 	file.read((char*)&RAM_bank_enabled, sizeof(RAM_bank_enabled));
 	file.read((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
 	file.read((char*)&mode, sizeof(mode));
-	cout << "read registers" << endl;
+}
+
+/*
+	Flat controller, ROM and external RAM are both plain memory
+*/
+Byte FlatController::read(Address location)
+{
+	return (location <= 0x7FFF) ? CART_ROM[location] : ERAM[location - 0xA000];
+}
+
+void FlatController::write(Address location, Byte data)
+{
+	if (location <= 0x7FFF)
+		CART_ROM[location] = data;
+	else
+		ERAM[location - 0xA000] = data;
 }
 
 /*
@@ -180,6 +236,7 @@ void MemoryController1::load_state(ifstream &file)
 */
 Byte MemoryController2::read(Address location) { return 0; }
 void MemoryController2::write(Address location, Byte data) {}
+Byte* MemoryController2::direct_pointer(Address) { return nullptr; }
 
 /*
 	Memory Controller 3
@@ -215,6 +272,15 @@ Byte MemoryController3::read(Address location)
 	}
 }
 
+// RTC registers have to go through read()
+Byte* MemoryController3::direct_pointer(Address location)
+{
+	if (location >= 0xA000 && RTC_enabled)
+		return nullptr;
+
+	return MemoryController::direct_pointer(location);
+}
+
 void MemoryController3::write(Address location, Byte data)
 {
 	if (location >= 0x0000 && location <= 0x1FFF)
@@ -277,7 +343,7 @@ void MemoryController3::write(Address location, Byte data)
 	}
 }
 
-void MemoryController3::save_state(ofstream &file)
+void MemoryController3::save_state(ostream &file)
 {
 	file.write((char*)&ROM_bank_id, sizeof(ROM_bank_id));
 	file.write((char*)&RAM_bank_id, sizeof(RAM_bank_id));
@@ -285,10 +351,9 @@ void MemoryController3::save_state(ofstream &file)
 	file.write((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
 	file.write((char*)&mode, sizeof(mode));
 	file.write((char*)&RTC_enabled, sizeof(RTC_enabled));
-	cout << "wrote registers" << endl;
 }
 
-void MemoryController3::load_state(ifstream &file)
+void MemoryController3::load_state(istream &file)
 {
 	file.read((char*)&ROM_bank_id, sizeof(ROM_bank_id));
 	file.read((char*)&RAM_bank_id, sizeof(RAM_bank_id));
@@ -296,5 +361,4 @@ void MemoryController3::load_state(ifstream &file)
 	file.read((char*)&RAM_access_enabled, sizeof(RAM_access_enabled));
 	file.read((char*)&mode, sizeof(mode));
 	file.read((char*)&RTC_enabled, sizeof(RTC_enabled));
-	cout << "read registers" << endl;
 }
\ No newline at end of file
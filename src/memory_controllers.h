@@ -28,31 +28,48 @@ class MemoryController
 		virtual Byte read(Address location) = 0;
 		virtual void write(Address location, Byte data) = 0;
 
+		Byte get_rom_bank();
+		virtual Byte get_ram_bank();
+		size_t get_rom_size();
+
+		// Plain memory behind a cartridge address in the selected bank, valid up to the end
+		// of its 256 byte page. nullptr when reads don't come straight from ROM or RAM
+		virtual Byte* direct_pointer(Address location);
+
 		// Save states
 		vector<Byte> get_ram();
 		void set_ram(vector<Byte> data);
-		virtual void save_state(ofstream &file);
-		virtual void load_state(ifstream &file);
+		virtual void save_state(ostream &file);
+		virtual void load_state(istream &file);
 };
 
 // This class represents games that only use the exact 32kB of cartridge space
 class MemoryController0 : public MemoryController {
 	Byte read(Address location);
 	void write(Address location, Byte data);
+	Byte* direct_pointer(Address location);
 };
 
 // MBC1 (max 2MByte ROM and/or 32KByte RAM)
 class MemoryController1 : public MemoryController {
 	Byte read(Address location);
+	Byte get_ram_bank();
 	void write(Address location, Byte data);
-	void save_state(ofstream &file);
-	void load_state(ifstream &file);
+	void save_state(ostream &file);
+	void load_state(istream &file);
 };
 
 // MBC2 (max 256KByte ROM and 512x4 bits RAM)
 class MemoryController2 : public MemoryController {
 	Byte read(Address location);
 	void write(Address location, Byte data);
+	Byte* direct_pointer(Address location);
+};
+
+// Cartridge space that reads and writes as plain memory, for CPU tests
+class FlatController : public MemoryController {
+	Byte read(Address location);
+	void write(Address location, Byte data);
 };
 
 // MBC3(max 2MByte ROM and / or 32KByte RAM and Timer)
@@ -62,6 +79,7 @@ class MemoryController3 : public MemoryController {
 
 	Byte read(Address locatison);
 	void write(Address location, Byte data);
-	void save_state(ofstream &file);
-	void load_state(ifstream &file);
+	Byte* direct_pointer(Address location);
+	void save_state(ostream &file);
+	void load_state(istream &file);
 };
@@ -0,0 +1,186 @@
+#include "movie.h"
+#include "compression.h"
+#include "parallel.h"
+
+#include <atomic>
+#include <memory>
+
+static const char MOVIE_MAGIC[4] = { 'G', 'B', 'M', 'V' };
+static const uint32_t MOVIE_VERSION = 2; // keyframes embed Emulator::save_state()
+
+bool Movie::save(string location)
+{
+	ofstream file(location, ios::binary | ios::trunc);
+
+	if (!file.is_open())
+		return false;
+
+	uint32_t interval = keyframe_interval;
+	uint32_t frame_count = (uint32_t) inputs.size();
+	uint32_t keyframe_count = (uint32_t) keyframes.size();
+
+	file.write(MOVIE_MAGIC, sizeof(MOVIE_MAGIC));
+	file.write((char*)&MOVIE_VERSION, sizeof(MOVIE_VERSION));
+	file.write((char*)&interval, sizeof(interval));
+	file.write((char*)&frame_count, sizeof(frame_count));
+	file.write((char*)inputs.data(), inputs.size());
+
+	file.write((char*)&keyframe_count, sizeof(keyframe_count));
+	for (const Keyframe &keyframe : keyframes)
+	{
+		uint32_t size = (uint32_t) keyframe.state.size();
+		file.write((char*)&keyframe.frame, sizeof(keyframe.frame));
+		file.write((char*)&keyframe.hash, sizeof(keyframe.hash));
+		file.write((char*)&size, sizeof(size));
+		file.write((char*)keyframe.state.data(), size);
+	}
+
+	return !file.bad();
+}
+
+bool Movie::load(string location)
+{
+	ifstream file(location, ios::binary);
+
+	if (!file.is_open())
+		return false;
+
+	char magic[4];
+	uint32_t version, interval, frame_count, keyframe_count;
+
+	file.read(magic, sizeof(magic));
+	file.read((char*)&version, sizeof(version));
+
+	if (!file || !equal(magic, magic + 4, MOVIE_MAGIC))
+	{
+		cout << "Not a movie file: " << location << endl;
+		return false;
+	}
+
+	if (version != MOVIE_VERSION)
+	{
+		cout << "Movie was recorded by a different version: " << location << endl;
+		return false;
+	}
+
+	file.read((char*)&interval, sizeof(interval));
+	file.read((char*)&frame_count, sizeof(frame_count));
+
+	keyframe_interval = interval;
+	inputs.resize(frame_count);
+	file.read((char*)inputs.data(), frame_count);
+
+	file.read((char*)&keyframe_count, sizeof(keyframe_count));
+	keyframes.resize(keyframe_count);
+
+	for (Keyframe &keyframe : keyframes)
+	{
+		uint32_t size;
+		file.read((char*)&keyframe.frame, sizeof(keyframe.frame));
+		file.read((char*)&keyframe.hash, sizeof(keyframe.hash));
+		file.read((char*)&size, sizeof(size));
+		keyframe.state.resize(size);
+		file.read((char*)keyframe.state.data(), size);
+	}
+
+	current_frame = 0;
+	return !file.fail();
+}
+
+void Movie::run_frame(Emulator &emulator)
+{
+	if (current_frame < inputs.size())
+		emulator.set_joypad(inputs[current_frame]);
+	else
+		inputs.push_back(emulator.get_joypad());
+
+	// Keyframes hold the frame's input already applied, the way it is while recording
+	bool keyframe_due = (current_frame % keyframe_interval == 0);
+	if (keyframe_due && (keyframes.empty() || keyframes.back().frame < current_frame))
+		add_keyframe(emulator);
+
+	emulator.run_frame();
+	current_frame++;
+}
+
+void Movie::seek(Emulator &emulator, size_t frame)
+{
+	frame = min(frame, inputs.size());
+
+	// Newest keyframe at or before the frame
+	auto keyframe = upper_bound(keyframes.begin(), keyframes.end(), frame,
+		[](size_t target, const Keyframe &keyframe) { return target < keyframe.frame; });
+
+	if (keyframe == keyframes.begin())
+		return;
+
+	restore_keyframe(emulator, *--keyframe);
+	current_frame = keyframe->frame;
+
+	while (current_frame < frame)
+		run_frame(emulator);
+}
+
+int Movie::verify(string rom_location)
+{
+	ifstream input(rom_location, ios::binary);
+	vector<Byte> rom((istreambuf_iterator<char>(input)), (istreambuf_iterator<char>()));
+
+	return verify(rom);
+}
+
+int Movie::verify(const vector<Byte> &rom)
+{
+	if (keyframes.size() < 2)
+		return 0;
+
+	atomic<int> failed(0);
+
+	// Every segment starts from its own keyframe, so each gets a fresh emulator
+	parallel_for(keyframes.size() - 1, [&](size_t id)
+	{
+		const Keyframe &start = keyframes[id];
+		const Keyframe &end = keyframes[id + 1];
+
+		unique_ptr<Emulator> emulator(new Emulator(true));
+		emulator->load_rom(rom, false);
+		restore_keyframe(*emulator, start);
+
+		for (size_t frame = start.frame; frame < end.frame; frame++)
+		{
+			emulator->set_joypad(inputs[frame]);
+			emulator->run_frame();
+		}
+
+		emulator->set_joypad(inputs[end.frame]);
+
+		if (emulator->state_hash() != end.hash)
+		{
+			cout << "Movie desyncs between frames " << start.frame << " and " << end.frame << endl;
+			failed++;
+		}
+	});
+
+	return failed;
+}
+
+void Movie::add_keyframe(Emulator &emulator)
+{
+	stringstream state;
+	emulator.save_state(state);
+	string data = state.str();
+
+	Keyframe keyframe;
+	keyframe.frame = (uint32_t) current_frame;
+	keyframe.hash = emulator.state_hash();
+	keyframe.state = compress((const Byte*) data.data(), data.size());
+
+	keyframes.push_back(keyframe);
+}
+
+void Movie::restore_keyframe(Emulator &emulator, const Keyframe &keyframe)
+{
+	vector<Byte> data = decompress(keyframe.state.data(), keyframe.state.size());
+	stringstream state(string(data.begin(), data.end()));
+	emulator.load_state(state);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <sstream>
+#include "emulator.h"
+
+// Joypad input for every frame since power on, with a compressed save state
+// (keyframe) every keyframe_interval frames. Seeking restores the nearest keyframe
+// and replays at most keyframe_interval frames, and each stretch between two
+// keyframes can be replayed and checked independently of the others.
+class Movie
+{
+	public:
+
+		int keyframe_interval = 600;
+
+		// INPUT_* buttons held during each frame
+		vector<Byte> inputs;
+
+		// Frame the attached emulator is about to run
+		size_t current_frame = 0;
+
+		bool save(string location);
+		bool load(string location);
+
+		// Plays back the recorded input for the frame, or records the current joypad
+		// state once past the end of the movie
+		void run_frame(Emulator &emulator);
+
+		// Put the emulator at the start of the given frame
+		void seek(Emulator &emulator, size_t frame);
+
+		// Replay every keyframe to keyframe segment in parallel, returns the number
+		// of segments that didn't reach the state stored in the next keyframe
+		int verify(string rom_location);
+		int verify(const vector<Byte> &rom);
+
+	private:
+
+		struct Keyframe
+		{
+			uint32_t frame;
+			uint64_t hash; // Emulator::state_hash() at the keyframe
+			vector<Byte> state; // compressed Emulator::save_state()
+		};
+
+		vector<Keyframe> keyframes;
+
+		void add_keyframe(Emulator &emulator);
+		void restore_keyframe(Emulator &emulator, const Keyframe &keyframe);
+};
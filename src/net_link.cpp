@@ -0,0 +1,263 @@
+#include "net_link.h"
+
+NetLink::NetLink(Emulator &_emulator)
+	: emulator(_emulator)
+{
+	event_cursor = emulator.cycles_run;
+	remote_cycle = emulator.cycles_run;
+}
+
+bool NetLink::host(unsigned short port)
+{
+	sf::TcpListener listener;
+
+	if (listener.listen(port) != sf::Socket::Done)
+		return false;
+
+	connected = (listener.accept(socket) == sf::Socket::Done);
+	socket.setBlocking(false);
+
+	return connected;
+}
+
+bool NetLink::connect(string address, unsigned short port)
+{
+	connected = (socket.connect(sf::IpAddress(address), port) == sf::Socket::Done);
+	socket.setBlocking(false);
+
+	return connected;
+}
+
+void NetLink::run_frame()
+{
+	receive();
+
+	// Too far ahead of the peer, its transfers could arrive older than our history
+	if (connected && emulator.cycles_run > remote_cycle + max_lead_frames * frame_cycles())
+	{
+		waits++;
+		return;
+	}
+
+	Frame frame;
+	frame.start_cycle = emulator.cycles_run;
+	frame.event_cursor = event_cursor;
+	frame.joypad_buttons = emulator.memory.joypad_buttons;
+	frame.joypad_arrows = emulator.memory.joypad_arrows;
+
+	stringstream state;
+	emulator.save_state(state);
+	frame.state = state.str();
+
+	history.push_back(frame);
+
+	if ((int) history.size() > rollback_frames)
+	{
+		history.pop_front();
+		prune(history.front().start_cycle);
+	}
+
+	simulate_frame(frame.start_cycle + frame_cycles());
+	send(CLOCK, emulator.cycles_run, 0);
+}
+
+uint64_t NetLink::frame_cycles()
+{
+	return (uint64_t) (emulator.cpu.CLOCK_SPEED / emulator.framerate);
+}
+
+// Run to the end of the frame, stopping for our own transfer starts and at
+// the cycles the peer started its transfers on
+void NetLink::simulate_frame(uint64_t end_cycle)
+{
+	while (emulator.cycles_run < end_cycle)
+	{
+		map<uint64_t, Byte>::iterator next = remote_transfers.lower_bound(event_cursor);
+		bool remote_event = (next != remote_transfers.end() && next->first < end_cycle);
+		uint64_t limit = remote_event ? next->first : end_cycle;
+
+		if (emulator.run_until(limit))
+		{
+			start_master_transfer();
+			continue;
+		}
+
+		if (remote_event)
+		{
+			slave_transfer(next->first, next->second);
+			event_cursor = next->first + 1;
+		}
+	}
+
+	event_cursor = max(event_cursor, end_cycle);
+	emulator.display.scanlines_rendered = 0;
+}
+
+// Our emulator just started a transfer on its own clock
+void NetLink::start_master_transfer()
+{
+	uint64_t cycle = emulator.cycles_run;
+
+	// Use the peer's answer when it's already known, otherwise predict it repeats itself
+	map<uint64_t, Byte>::iterator confirmed = confirmed_replies.find(cycle);
+	Byte reply = (confirmed != confirmed_replies.end()) ? confirmed->second : last_reply;
+
+	emulator.serial_incoming = reply;
+	used_replies[cycle] = reply;
+
+	if (sent_transfers.insert(cycle).second)
+		send(MASTER_TRANSFER, cycle, emulator.memory.SB.get());
+}
+
+// The peer clocked a transfer, shift its byte in if we have a transfer armed
+void NetLink::slave_transfer(uint64_t cycle, Byte data)
+{
+	Byte reply = 0xFF;
+
+	if ((emulator.memory.SC.get() & 0x81) == 0x80 && emulator.serial_counter == 0)
+	{
+		reply = emulator.memory.SB.get();
+
+		// Late events are applied now, the remaining bit time is kept
+		int elapsed = (int) (emulator.cycles_run - min(cycle, emulator.cycles_run));
+		emulator.serial_counter = max(1, 8 * 512 - elapsed);
+		emulator.serial_incoming = data;
+		emulator.serial_output.push_back(reply);
+	}
+
+	map<uint64_t, Byte>::iterator sent = sent_replies.find(cycle);
+	if (sent == sent_replies.end() || sent->second != reply)
+	{
+		sent_replies[cycle] = reply;
+		send(SLAVE_REPLY, cycle, reply);
+	}
+}
+
+void NetLink::receive()
+{
+	if (!connected)
+		return;
+
+	uint64_t rollback_cycle = UINT64_MAX;
+	sf::Packet packet;
+
+	while (socket.receive(packet) == sf::Socket::Done)
+	{
+		sf::Uint8 type, data;
+		sf::Uint32 high, low;
+
+		if (!(packet >> type >> high >> low >> data))
+			continue;
+
+		uint64_t cycle = ((uint64_t) high << 32) | low;
+
+		if (type == MASTER_TRANSFER)
+		{
+			remote_transfers[cycle] = data;
+
+			// Already simulated past the point the peer started the transfer
+			if (cycle < event_cursor)
+				rollback_cycle = min(rollback_cycle, cycle);
+		}
+		else if (type == SLAVE_REPLY)
+		{
+			confirmed_replies[cycle] = data;
+			last_reply = data;
+
+			// Replies older than the history can't be checked against what we assumed
+			map<uint64_t, Byte>::iterator used = used_replies.find(cycle);
+			bool mispredicted = (used != used_replies.end() && used->second != data);
+			bool too_old = (!history.empty() && cycle < history.front().start_cycle);
+
+			if (mispredicted || too_old)
+				rollback_cycle = min(rollback_cycle, cycle);
+		}
+		else if (type == CLOCK)
+		{
+			remote_cycle = max(remote_cycle, cycle);
+		}
+	}
+
+	if (rollback_cycle != UINT64_MAX)
+		rollback(rollback_cycle);
+}
+
+void NetLink::send(MessageType type, uint64_t cycle, Byte data)
+{
+	if (!connected)
+		return;
+
+	sf::Packet packet;
+	packet << (sf::Uint8) type << (sf::Uint32) (cycle >> 32) << (sf::Uint32) (cycle & 0xFFFFFFFF) << (sf::Uint8) data;
+
+	sf::Socket::Status status = socket.send(packet);
+	while (status == sf::Socket::Partial)
+		status = socket.send(packet);
+}
+
+// Restore the newest frame that started before the cycle and re-simulate every frame since
+void NetLink::rollback(uint64_t cycle)
+{
+	if (history.empty())
+		return;
+
+	// Nothing left to restore from, the two sides can't be brought back in step
+	if (cycle < history.front().start_cycle)
+	{
+		disconnect("transfer at cycle " + to_string(cycle) + " is older than the rollback history");
+		return;
+	}
+
+	size_t first = 0;
+	for (size_t i = 0; i < history.size(); i++)
+	{
+		if (history[i].start_cycle <= cycle)
+			first = i;
+	}
+
+	rollbacks++;
+
+	for (size_t i = first; i < history.size(); i++)
+	{
+		Frame &frame = history[i];
+
+		if (i == first)
+		{
+			stringstream state(frame.state);
+			emulator.load_state(state);
+			event_cursor = frame.event_cursor;
+		}
+		else
+		{
+			stringstream state;
+			emulator.save_state(state);
+			frame.state = state.str();
+			frame.start_cycle = emulator.cycles_run;
+			frame.event_cursor = event_cursor;
+		}
+
+		emulator.memory.joypad_buttons = frame.joypad_buttons;
+		emulator.memory.joypad_arrows = frame.joypad_arrows;
+
+		simulate_frame(frame.start_cycle + frame_cycles());
+	}
+}
+
+// The game carries on unlinked, as if the cable was pulled
+void NetLink::disconnect(string reason)
+{
+	cout << "Link desynced, disconnecting: " << reason << endl;
+
+	socket.disconnect();
+	connected = false;
+}
+
+// Forget transfers older than the oldest frame we can still roll back to
+void NetLink::prune(uint64_t cycle)
+{
+	remote_transfers.erase(remote_transfers.begin(), remote_transfers.lower_bound(cycle));
+	confirmed_replies.erase(confirmed_replies.begin(), confirmed_replies.lower_bound(cycle));
+	used_replies.erase(used_replies.begin(), used_replies.lower_bound(cycle));
+	sent_replies.erase(sent_replies.begin(), sent_replies.lower_bound(cycle));
+	sent_transfers.erase(sent_transfers.begin(), sent_transfers.lower_bound(cycle));
+}
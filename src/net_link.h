@@ -0,0 +1,89 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <set>
+#include <sstream>
+
+#include <SFML\Network.hpp>
+#include "emulator.h"
+
+// Link cable between two processes over a loopback TCP socket. Neither side ever waits
+// for the other: a master predicts the byte it will shift in and keeps running, and
+// transfers reported late by the peer are handled by restoring a snapshot from before
+// the transfer and re-simulating the frames since with the recorded inputs. The faster
+// side waits once it gets too far ahead of the peer's clock to roll back to.
+class NetLink
+{
+	public:
+
+		NetLink(Emulator &_emulator);
+
+		// Frames of history kept for rolling back
+		int rollback_frames = 120;
+
+		// Frames this side may run ahead of the peer's last reported clock. Kept well inside
+		// rollback_frames, so anything the peer reports late can still be rolled back
+		int max_lead_frames = 30;
+
+		// Number of times a late or mispredicted transfer caused a rollback
+		int rollbacks = 0;
+
+		// Frames skipped waiting for the peer to catch up
+		int waits = 0;
+
+		bool host(unsigned short port);
+		bool connect(string address, unsigned short port);
+
+		// Advance the local emulator by one frame with the current joypad state
+		void run_frame();
+
+	private:
+
+		enum MessageType : Byte
+		{
+			MASTER_TRANSFER = 0, // peer started a transfer on its clock
+			SLAVE_REPLY = 1,     // peer's byte for one of our transfers
+			CLOCK = 2            // peer finished a frame at this cycle
+		};
+
+		struct Frame
+		{
+			uint64_t start_cycle;
+			uint64_t event_cursor;
+			string state;
+			Byte joypad_buttons;
+			Byte joypad_arrows;
+		};
+
+		Emulator &emulator;
+		sf::TcpSocket socket;
+		bool connected = false;
+
+		deque<Frame> history;
+
+		uint64_t remote_cycle = 0; // last cycle the peer reported reaching
+
+		// Peer transfers by the cycle they started on, to replay as the slave
+		map<uint64_t, Byte> remote_transfers;
+		uint64_t event_cursor = 0; // remote transfers before this cycle have been handled
+
+		// Our transfers as master: what the peer replied, and what we assumed
+		map<uint64_t, Byte> confirmed_replies;
+		map<uint64_t, Byte> used_replies;
+		set<uint64_t> sent_transfers;
+		Byte last_reply = 0xFF;
+
+		// Replies sent to the peer, resent if a re-simulation changes one
+		map<uint64_t, Byte> sent_replies;
+
+		void receive();
+		void send(MessageType type, uint64_t cycle, Byte data);
+		uint64_t frame_cycles();
+		void simulate_frame(uint64_t end_cycle);
+		void start_master_transfer();
+		void slave_transfer(uint64_t cycle, Byte data);
+		void rollback(uint64_t cycle);
+		void disconnect(string reason);
+		void prune(uint64_t cycle);
+};
@@ -274,8 +274,8 @@ void CPU::parse_bit_op(Opcode code)
 
 void CPU::parse_opcode(Opcode code)
 {
-	Byte value  = memory->read(reg_PC + 1);
-	Byte value2 = memory->read(reg_PC + 2);
+	Byte value  = memory->fetch(reg_PC + 1);
+	Byte value2 = memory->fetch(reg_PC + 2);
 
 	// REG_D could possibly be incorrect, assumed current value from manual to match GBCPUman
 	switch (code)
@@ -540,7 +540,11 @@ void CPU::parse_opcode(Opcode code)
 		case 0xE7: op(1, 4); RST(0x20); break;
 		case 0xEF: op(1, 4); RST(0x28); break;
 		case 0xF7: op(1, 4); RST(0x30); break;
-		case 0xFF: op(1, 4); RST(0x38); break;
+		case 0xFF:
+			// Executing RST 38 from $0038 jumps back to itself forever
+			if (reg_PC == 0x38)
+				stop_reason = StopReason::RST_38_SPIN;
+			op(1, 4); RST(0x38); break;
 		// 110-111
 		case 0x27: DAA(); op(1, 1); break;
 		case 0x2F: CPL(); op(1, 1); break;
@@ -551,12 +555,14 @@ void CPU::parse_opcode(Opcode code)
 		case 0xFB: EI(); op(1, 1); break; // Enable interrupts
 		// 112
 		case 0x76: HALT(); op(1, 1); break;
-		// case 0x10: STOP(); op(2, 1); break; // UNIMPLEMENTED
+		case 0x10: STOP(); op(2, 1); break;
 
 		// Pandocs
 		case 0x37: SCF(); op(1, 1); break;
 		case 0x3F: CCF(); op(1, 1); break;
 
-		default: op(1, 0); break;
+		default:
+			stop_reason = StopReason::ILLEGAL_OPCODE;
+			op(1, 0); break;
 	}
 }
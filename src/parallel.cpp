@@ -0,0 +1,24 @@
+#include "parallel.h"
+
+#include <atomic>
+#include <thread>
+
+void parallel_for(size_t count, const function<void(size_t)> &body)
+{
+	atomic<size_t> next(0);
+
+	size_t worker_count = min((size_t) max(1u, thread::hardware_concurrency()), count);
+	vector<thread> workers;
+
+	for (size_t i = 0; i < worker_count; i++)
+	{
+		workers.push_back(thread([&]()
+		{
+			for (size_t id = next++; id < count; id = next++)
+				body(id);
+		}));
+	}
+
+	for (thread &worker : workers)
+		worker.join();
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <functional>
+#include "types.h"
+
+// Calls body(id) for every id in [0, count), spread over one thread per hardware thread.
+// Each thread pulls the next id as it finishes one, so uneven jobs still balance out.
+// Returns once every call has
+void parallel_for(size_t count, const function<void(size_t)> &body);
@@ -0,0 +1,120 @@
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+PerfCounters::PerfCounters()
+{
+	fill(fds, fds + COUNTER_COUNT, -1);
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+	for (int fd : fds)
+	{
+		if (fd >= 0)
+			close(fd);
+	}
+#endif
+}
+
+// Opens the counters as one group so they are scheduled and read together. Counters the
+// CPU or virtual machine doesn't support are left out.
+bool PerfCounters::open()
+{
+#ifdef __linux__
+	struct Event { Counter counter; uint32_t type; uint64_t config; };
+
+	const uint64_t l1_read_miss = PERF_COUNT_HW_CACHE_L1D
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+	const Event events[] = {
+		{ CYCLES,        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ INSTRUCTIONS,  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		{ L1_MISSES,     PERF_TYPE_HW_CACHE, l1_read_miss },
+		{ LLC_MISSES,    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES }
+	};
+
+	for (const Event &event : events)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = event.type;
+		attr.config = event.config;
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.disabled = (leader < 0) ? 1 : 0;
+
+		int fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+
+		// Without cycles there's no group to join
+		if (fd < 0 && leader < 0)
+			return false;
+		if (fd < 0)
+			continue;
+
+		if (leader < 0)
+			leader = fd;
+
+		fds[event.counter] = fd;
+		group_order.push_back(event.counter);
+	}
+
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool PerfCounters::available()
+{
+	return leader >= 0;
+}
+
+bool PerfCounters::has_counter(Counter counter)
+{
+	return fds[counter] >= 0;
+}
+
+void PerfCounters::begin_frame()
+{
+	read(frame_start);
+}
+
+void PerfCounters::end_frame()
+{
+	Sample now, frame;
+	read(now);
+
+	for (int i = 0; i < COUNTER_COUNT; i++)
+		frame.values[i] = now.values[i] - frame_start.values[i];
+
+	frames.push_back(frame);
+}
+
+void PerfCounters::read(Sample &sample)
+{
+#ifdef __linux__
+	if (leader < 0)
+		return;
+
+	// Group read: number of counters, then each value in the order they were opened
+	uint64_t buffer[1 + COUNTER_COUNT];
+	if (::read(leader, buffer, sizeof(buffer)) < (ssize_t) sizeof(uint64_t))
+		return;
+
+	for (size_t i = 0; i < group_order.size() && i < buffer[0]; i++)
+		sample.values[group_order[i]] = buffer[1 + i];
+#endif
+}
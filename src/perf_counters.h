@@ -0,0 +1,93 @@
+#pragma once
+
+#include "types.h"
+
+// Hardware performance counters of the emulation thread through Linux perf_event_open.
+// Frame totals are exact, one counter read per frame. The split between subsystems is
+// sampled instead, every sample_interval steps the counters are read around each part
+// of Emulator::step() since a read per step would cost more than the step itself.
+// On other platforms, or without permission to open counters, available() is false and
+// everything else does nothing.
+class PerfCounters
+{
+	public:
+
+		enum Counter
+		{
+			CYCLES,
+			INSTRUCTIONS,
+			BRANCH_MISSES,
+			L1_MISSES,  // L1 data cache read misses
+			LLC_MISSES, // last level cache misses
+			COUNTER_COUNT
+		};
+
+		enum Subsystem
+		{
+			CPU_CORE, // instruction execution and interrupt dispatch
+			TIMERS,   // divider, timer and serial
+			PPU,      // scanline timing and rendering
+			SUBSYSTEM_COUNT
+		};
+
+		struct Sample
+		{
+			uint64_t values[COUNTER_COUNT] = { 0 };
+
+			double ipc() const { return values[CYCLES] ? (double) values[INSTRUCTIONS] / values[CYCLES] : 0; }
+		};
+
+		PerfCounters();
+		~PerfCounters();
+
+		bool open();
+		bool available();
+		bool has_counter(Counter counter);
+
+		int sample_interval = 1024;
+
+		// One entry per frame run while counting
+		vector<Sample> frames;
+
+		// Sampled counts per subsystem, only meaningful as shares of their sum
+		Sample subsystems[SUBSYSTEM_COUNT];
+
+		// Called by Emulator::run_frame()
+		void begin_frame();
+		void end_frame();
+
+		// Called by Emulator::step(), only read the counters on sampled steps
+		void begin_step()
+		{
+			sampling = (++steps % sample_interval == 0);
+			if (sampling)
+				read(phase_start);
+		}
+
+		void end_phase(Subsystem subsystem)
+		{
+			if (!sampling)
+				return;
+
+			Sample now;
+			read(now);
+
+			for (int i = 0; i < COUNTER_COUNT; i++)
+				subsystems[subsystem].values[i] += now.values[i] - phase_start.values[i];
+
+			phase_start = now;
+		}
+
+	private:
+
+		int leader = -1;
+		int fds[COUNTER_COUNT];
+		vector<Counter> group_order; // counters in the order the group read returns them
+
+		uint64_t steps = 0;
+		bool sampling = false;
+		Sample phase_start;
+		Sample frame_start;
+
+		void read(Sample &sample);
+};
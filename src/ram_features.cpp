@@ -0,0 +1,138 @@
+#include "ram_features.h"
+
+// Split the range wherever direct access changes or a 256 byte page ends, and merge
+// with the previous step when it continues it
+void RamFeatures::add_range(Address start, int length)
+{
+	feature_count += length;
+
+	while (length > 0)
+	{
+		bool direct = is_direct(start);
+		int page_left = 0x100 - (start & 0xFF);
+		int count = direct ? min(length, page_left) : 1;
+		Operation operation = direct ? COPY : READ;
+
+		if (!plan.empty())
+		{
+			Step &last = plan.back();
+			bool same_page = ((last.location + last.length - 1) >> 8) == (start >> 8);
+
+			if (last.operation == operation && last.location + last.length == start
+				&& (operation == READ || same_page))
+			{
+				last.length += count;
+				start += count;
+				length -= count;
+				continue;
+			}
+		}
+
+		plan.push_back({ operation, start, count, false, direct });
+		start += count;
+		length -= count;
+	}
+}
+
+void RamFeatures::add_byte(Address location)
+{
+	add_range(location, 1);
+}
+
+void RamFeatures::add_u16(Address location)
+{
+	plan.push_back({ U16, location, 2, true, is_direct(location, 2) });
+	feature_count++;
+}
+
+void RamFeatures::add_bcd(Address location, int bytes, bool little_endian)
+{
+	// 8 bytes are already more digits than a float holds
+	bytes = min(bytes, 8);
+
+	plan.push_back({ BCD, location, bytes, little_endian, is_direct(location, bytes) });
+	feature_count++;
+}
+
+int RamFeatures::size()
+{
+	return feature_count;
+}
+
+void RamFeatures::gather(Memory &memory, float* output)
+{
+	for (const Step &step : plan)
+	{
+		switch (step.operation)
+		{
+			case COPY:
+			{
+				const Byte* source = memory.direct_pointer(step.location);
+				for (int i = 0; i < step.length; i++)
+					*output++ = source[i];
+				break;
+			}
+			case READ:
+			{
+				for (int i = 0; i < step.length; i++)
+					*output++ = memory.peek(step.location + i);
+				break;
+			}
+			case U16:
+			{
+				const Byte* source = step.direct ? memory.direct_pointer(step.location) : nullptr;
+
+				if (source)
+					*output++ = combine(source[1], source[0]);
+				else
+					*output++ = combine(memory.peek(step.location + 1), memory.peek(step.location));
+				break;
+			}
+			case BCD:
+			{
+				Byte bytes[8];
+				const Byte* source = step.direct ? memory.direct_pointer(step.location) : nullptr;
+
+				if (!source)
+				{
+					for (int i = 0; i < step.length; i++)
+						bytes[i] = memory.peek(step.location + i);
+					source = bytes;
+				}
+
+				double value = 0;
+				for (int i = 0; i < step.length; i++)
+				{
+					Byte digits = source[step.little_endian ? step.length - 1 - i : i];
+					value = value * 100 + high_nibble(digits) * 10 + low_nibble(digits);
+				}
+				*output++ = (float) value;
+				break;
+			}
+		}
+	}
+}
+
+void RamFeatures::gather(const vector<Emulator*> &batch, float* output)
+{
+	for (Emulator* emulator : batch)
+	{
+		gather(emulator->memory, output);
+		output += feature_count;
+	}
+}
+
+// Plain RAM, except P1 which is built from the joypad state on every read
+bool RamFeatures::is_direct(Address location)
+{
+	return (location >= 0x8000 && location <= 0x9FFF)
+		|| (location >= 0xC000 && location <= 0xFEFF)
+		|| location >= 0xFF01;
+}
+
+// Every byte direct and inside one 256 byte page, so one pointer covers them all
+bool RamFeatures::is_direct(Address location, int length)
+{
+	Address last = location + length - 1;
+	return is_direct(location) && is_direct(last) && (location >> 8) == (last >> 8);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "emulator.h"
+
+// A fixed list of memory addresses turned into a feature vector every step. Addresses
+// are registered once and compiled into runs of bytes that can be copied straight out
+// of RAM, so gathering a batch doesn't go through Memory::peek() byte by byte.
+class RamFeatures
+{
+	public:
+
+		// One feature per byte
+		void add_range(Address start, int length);
+		void add_byte(Address location);
+
+		// One feature per value
+		void add_u16(Address location); // little endian, low byte first
+		void add_bcd(Address location, int bytes = 1, bool little_endian = false); // packed BCD
+
+		// Features per instance
+		int size();
+
+		// Fill one row of size() features
+		void gather(Memory &memory, float* output);
+
+		// Fill a [batch.size()][size()] tensor, one row per instance
+		void gather(const vector<Emulator*> &batch, float* output);
+
+	private:
+
+		enum Operation
+		{
+			COPY, // length bytes straight from RAM
+			READ, // length bytes through Memory::peek()
+			U16,
+			BCD
+		};
+
+		struct Step
+		{
+			Operation operation;
+			Address location;
+			int length;
+			bool little_endian;
+			bool direct; // U16 and BCD, every byte is plain RAM within one page
+		};
+
+		vector<Step> plan;
+		int feature_count = 0;
+
+		bool is_direct(Address location);
+		bool is_direct(Address location, int length);
+};
@@ -0,0 +1,145 @@
+#include "resampler.h"
+
+#if defined(__AVX__) || defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+static const double PI = 3.14159265358979323846;
+
+// Input frames before the one an output frame is centred on
+static const int HISTORY = Resampler::TAPS / 2 - 1;
+
+static inline float dot(const float* samples, const float* taps)
+{
+#if defined(__AVX__)
+	__m256 sum = _mm256_setzero_ps();
+	for (int i = 0; i < Resampler::TAPS; i += 8)
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(samples + i), _mm256_loadu_ps(taps + i)));
+
+	__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+	half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+	half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+	return _mm_cvtss_f32(half);
+#elif defined(__SSE__) || defined(_M_X64)
+	__m128 sum = _mm_setzero_ps();
+	for (int i = 0; i < Resampler::TAPS; i += 4)
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(samples + i), _mm_loadu_ps(taps + i)));
+
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+#else
+	float sum = 0;
+	for (int i = 0; i < Resampler::TAPS; i++)
+		sum += samples[i] * taps[i];
+	return sum;
+#endif
+}
+
+static inline int16_t to_sample(float value)
+{
+	return (int16_t) max(-32768.0f, min(32767.0f, value * 32768));
+}
+
+Resampler::Resampler(double _ratio)
+	: ratio(_ratio)
+{
+	design();
+	clear();
+}
+
+void Resampler::set_ratio(double _ratio)
+{
+	ratio = _ratio;
+
+	// Cutoff only depends on the ratio when downsampling
+	double wanted = max(1.0, ratio);
+	if (wanted > designed_ratio * 1.1 || wanted < designed_ratio / 1.1)
+		design();
+}
+
+void Resampler::write(const float* samples, size_t frames)
+{
+	for (size_t i = 0; i < frames; i++)
+	{
+		left.push_back(samples[i * 2]);
+		right.push_back(samples[i * 2 + 1]);
+	}
+}
+
+size_t Resampler::available()
+{
+	// The last input frame an output needs is at floor(position) + TAPS / 2
+	double last = (double) left.size() - TAPS / 2 - 1 - position;
+
+	if (last < 0)
+		return 0;
+
+	return (size_t) (last / ratio) + 1;
+}
+
+size_t Resampler::read(int16_t* output, size_t frames)
+{
+	frames = min(frames, available());
+
+	for (size_t i = 0; i < frames; i++)
+	{
+		size_t index = (size_t) position;
+		int phase = (int) ((position - index) * PHASES);
+
+		const float* taps = &coefficients[phase * TAPS];
+		size_t start = index - HISTORY;
+
+		output[i * 2] = to_sample(dot(&left[start], taps));
+		output[i * 2 + 1] = to_sample(dot(&right[start], taps));
+
+		position += ratio;
+	}
+
+	// Drop input no output will need again
+	size_t consumed = (size_t) position - HISTORY;
+	left.erase(left.begin(), left.begin() + consumed);
+	right.erase(right.begin(), right.begin() + consumed);
+	position -= consumed;
+
+	return frames;
+}
+
+void Resampler::clear()
+{
+	left.assign(HISTORY, 0);
+	right.assign(HISTORY, 0);
+	position = HISTORY;
+}
+
+// Blackman windowed sinc with the cutoff just under the lower of the two Nyquist rates,
+// one row per phase, each normalized to unity gain
+void Resampler::design()
+{
+	designed_ratio = max(1.0, ratio);
+	double cutoff = 0.45 / designed_ratio;
+
+	coefficients.resize(PHASES * TAPS);
+
+	for (int phase = 0; phase < PHASES; phase++)
+	{
+		float* row = &coefficients[phase * TAPS];
+		double sum = 0;
+
+		for (int tap = 0; tap < TAPS; tap++)
+		{
+			double distance = tap - HISTORY - (double) phase / PHASES;
+			double x = 2 * cutoff * distance;
+			double sinc = (x == 0) ? 1 : sin(PI * x) / (PI * x);
+
+			double w = (distance + TAPS / 2.0) / TAPS;
+			double window = 0.42 - 0.5 * cos(2 * PI * w) + 0.08 * cos(4 * PI * w);
+
+			row[tap] = (float) (sinc * window);
+			sum += row[tap];
+		}
+
+		for (int tap = 0; tap < TAPS; tap++)
+			row[tap] = (float) (row[tap] / sum);
+	}
+}
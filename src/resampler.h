@@ -0,0 +1,45 @@
+#pragma once
+
+#include "types.h"
+
+// Polyphase FIR resampler for interleaved stereo. The ratio of input to output frames
+// can change between reads, the windowed sinc table is only redesigned when it moves
+// far enough that the cutoff no longer fits. The dot products use AVX or SSE when the
+// compiler targets them.
+class Resampler
+{
+	public:
+
+		static const int TAPS = 32;    // input frames per output frame
+		static const int PHASES = 256; // sub-sample positions in the table
+
+		Resampler(double _ratio = 1);
+
+		// Input frames consumed per output frame
+		void set_ratio(double _ratio);
+		double get_ratio() { return ratio; }
+
+		void write(const float* samples, size_t frames);
+
+		// Output frames that can be produced from the buffered input
+		size_t available();
+
+		// Produces up to a number of interleaved output frames, returns how many
+		size_t read(int16_t* output, size_t frames);
+
+		// Drop all buffered input
+		void clear();
+
+	private:
+
+		double ratio;
+		double designed_ratio = 0;
+		vector<float> coefficients; // PHASES rows of TAPS
+
+		// Planar history, position is the next output in input frames from their start
+		vector<float> left;
+		vector<float> right;
+		double position;
+
+		void design();
+};
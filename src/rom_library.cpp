@@ -0,0 +1,274 @@
+#include "rom_library.h"
+#include "parallel.h"
+
+#include <cstring>
+#include <filesystem>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(RomRecord) == 48, "RomRecord is stored in index files as is");
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(string location)
+{
+	close();
+
+#ifdef __linux__
+	int fd = ::open(location.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	length = (size_t) info.st_size;
+
+	// Empty files can't be mapped, they simply have no bytes
+	if (length > 0)
+	{
+		void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (address == MAP_FAILED)
+		{
+			::close(fd);
+			length = 0;
+			return false;
+		}
+
+		bytes = (const Byte*) address;
+		mapped = true;
+	}
+
+	// The mapping stays valid without the descriptor
+	::close(fd);
+	return true;
+#else
+	ifstream input(location, ios::binary);
+	if (!input.is_open())
+		return false;
+
+	buffer.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+	bytes = buffer.data();
+	length = buffer.size();
+	return true;
+#endif
+}
+
+void MappedFile::close()
+{
+#ifdef __linux__
+	if (mapped)
+		munmap((void*) bytes, length);
+#endif
+
+	bytes = nullptr;
+	length = 0;
+	mapped = false;
+	buffer.clear();
+}
+
+int RomLibrary::build(string directory, string index_location)
+{
+	vector<string> locations;
+
+	for (const auto &entry : filesystem::recursive_directory_iterator(directory))
+	{
+		string extension = entry.path().extension().string();
+		if (entry.is_regular_file() && (extension == ".gb" || extension == ".gbc"))
+			locations.push_back(entry.path().string());
+	}
+
+	sort(locations.begin(), locations.end());
+
+	// Each job only writes its own record, so nothing needs locking
+	vector<RomRecord> roms(locations.size());
+	vector<char> valid(locations.size(), 0);
+
+	parallel_for(locations.size(), [&](size_t id)
+	{
+		valid[id] = read_rom(locations[id], roms[id]);
+	});
+
+	// Drop files too short to hold a header and lay out the path strings
+	vector<RomRecord> records;
+	string strings;
+
+	for (size_t id = 0; id < locations.size(); id++)
+	{
+		if (!valid[id])
+			continue;
+
+		RomRecord rom = roms[id];
+		rom.path_offset = (uint32_t) strings.size();
+		rom.path_length = (uint32_t) locations[id].size();
+		strings += locations[id];
+		records.push_back(rom);
+	}
+
+	// Records by hash for lookups by content, then the title order over them
+	stable_sort(records.begin(), records.end(), [](const RomRecord &a, const RomRecord &b)
+	{
+		return a.content_hash < b.content_hash;
+	});
+
+	vector<uint32_t> title_order(records.size());
+	for (size_t id = 0; id < records.size(); id++)
+		title_order[id] = (uint32_t) id;
+
+	stable_sort(title_order.begin(), title_order.end(), [&](uint32_t a, uint32_t b)
+	{
+		return strcmp(records[a].title, records[b].title) < 0;
+	});
+
+	ofstream file(index_location, ios::binary | ios::trunc);
+
+	if (!file.is_open())
+		return -1;
+
+	IndexHeader header = { { 'G', 'B', 'R', 'I' }, VERSION, (uint32_t) records.size(), (uint32_t) strings.size() };
+
+	file.write((char*)&header, sizeof(header));
+	file.write((char*)records.data(), records.size() * sizeof(RomRecord));
+	file.write((char*)title_order.data(), title_order.size() * sizeof(uint32_t));
+	file.write(strings.data(), strings.size());
+
+	return file.bad() ? -1 : (int) records.size();
+}
+
+// Fills in a record from the cartridge header, the hash and the global checksum each
+// read the whole file
+bool RomLibrary::read_rom(string location, RomRecord &rom)
+{
+	MappedFile file;
+
+	if (!file.open(location) || file.size() < 0x150)
+		return false;
+
+	const Byte* data = file.data();
+	size_t size = file.size();
+
+	rom = RomRecord();
+	rom.content_hash = hash_bytes(data, size);
+	rom.file_size = (uint32_t) size;
+
+	for (int i = 0x0134; i <= 0x0142; i++)
+	{
+		Byte character = data[i];
+		if (character == 0)
+			break;
+		rom.title[i - 0x0134] = (char) tolower(character);
+	}
+
+	rom.cgb_flag = data[0x0143];
+	rom.sgb_flag = data[0x0146];
+	rom.cart_type = data[0x0147];
+	rom.rom_size = data[0x0148];
+	rom.ram_size = data[0x0149];
+	rom.destination = data[0x014A];
+	rom.header_checksum = data[0x014D];
+	rom.global_checksum = combine(data[0x014E], data[0x014F]);
+
+	// What the boot ROM checks: x = x - byte - 1 over $0134 - $014C
+	Byte header_sum = 0;
+	for (int i = 0x0134; i <= 0x014C; i++)
+		header_sum = header_sum - data[i] - 1;
+
+	// Sum of every byte except the checksum itself, the boot ROM never checks it
+	Byte_2 global_sum = 0;
+	for (size_t i = 0; i < size; i++)
+		global_sum += data[i];
+	global_sum -= data[0x014E] + data[0x014F];
+
+	if (header_sum == rom.header_checksum)
+		rom.checksums_valid |= RomRecord::HEADER_VALID;
+	if (global_sum == rom.global_checksum)
+		rom.checksums_valid |= RomRecord::GLOBAL_VALID;
+
+	return true;
+}
+
+bool RomLibrary::open(string index_location)
+{
+	count = 0;
+
+	if (!file.open(index_location) || file.size() < sizeof(IndexHeader))
+		return false;
+
+	const IndexHeader* header = (const IndexHeader*) file.data();
+
+	if (memcmp(header->magic, "GBRI", 4) != 0 || header->version != VERSION)
+		return false;
+
+	size_t expected = sizeof(IndexHeader) + header->count * (sizeof(RomRecord) + sizeof(uint32_t))
+		+ header->strings_size;
+
+	if (file.size() < expected)
+		return false;
+
+	count = header->count;
+	records = (const RomRecord*) (file.data() + sizeof(IndexHeader));
+	title_order = (const uint32_t*) (records + count);
+	strings = (const char*) (title_order + count);
+	strings_size = header->strings_size;
+	return true;
+}
+
+string RomLibrary::get_path(const RomRecord &rom)
+{
+	if ((size_t) rom.path_offset + rom.path_length > strings_size)
+		return "";
+
+	return string(strings + rom.path_offset, rom.path_length);
+}
+
+const RomRecord* RomLibrary::find_hash(uint64_t hash)
+{
+	const RomRecord* end = records + count;
+	const RomRecord* found = lower_bound(records, end, hash, [](const RomRecord &rom, uint64_t value)
+	{
+		return rom.content_hash < value;
+	});
+
+	return (found != end && found->content_hash == hash) ? found : nullptr;
+}
+
+vector<const RomRecord*> RomLibrary::find_title(string title)
+{
+	transform(title.begin(), title.end(), title.begin(), [](char c) { return (char) tolower(c); });
+
+	const uint32_t* end = title_order + count;
+	const uint32_t* id = lower_bound(title_order, end, title, [&](uint32_t rom, const string &value)
+	{
+		return strcmp(records[rom].title, value.c_str()) < 0;
+	});
+
+	vector<const RomRecord*> found;
+	for (; id != end && title == records[*id].title; id++)
+		found.push_back(&records[*id]);
+
+	return found;
+}
+
+vector<const RomRecord*> RomLibrary::find(string title_or_hash)
+{
+	bool is_hash = title_or_hash.size() == 16
+		&& all_of(title_or_hash.begin(), title_or_hash.end(), [](char c) { return isxdigit((unsigned char) c) != 0; });
+
+	if (!is_hash)
+		return find_title(title_or_hash);
+
+	const RomRecord* rom = find_hash(stoull(title_or_hash, nullptr, 16));
+	return rom ? vector<const RomRecord*>{ rom } : vector<const RomRecord*>();
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "types.h"
+
+// Read only view of a whole file. Mapped on Linux so the pages are only read when
+// touched, read into memory elsewhere.
+class MappedFile
+{
+	public:
+
+		MappedFile() {}
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool open(string location);
+		void close();
+
+		const Byte* data() { return bytes; }
+		size_t size() { return length; }
+
+	private:
+
+		const Byte* bytes = nullptr;
+		size_t length = 0;
+		bool mapped = false;
+		vector<Byte> buffer; // contents when not mapped
+};
+
+// Cartridge header fields and checksums of one ROM, as stored in the library index
+struct RomRecord
+{
+	uint64_t content_hash;    // hash_bytes() of the whole file
+	uint32_t file_size;
+	uint32_t path_offset;     // into the index string table
+	uint32_t path_length;
+	char title[16];           // $0134 - $0142, lower case like Memory::rom_name, zero padded
+	Byte cgb_flag;            // $0143
+	Byte sgb_flag;            // $0146
+	Byte cart_type;           // $0147
+	Byte rom_size;            // $0148
+	Byte ram_size;            // $0149
+	Byte destination;         // $014A
+	Byte header_checksum;     // $014D
+	Byte checksums_valid;     // HEADER_VALID | GLOBAL_VALID
+	Byte_2 global_checksum;   // $014E - $014F, stored big endian in the ROM
+
+	static const Byte
+		HEADER_VALID = 0x01,
+		GLOBAL_VALID = 0x02;
+
+	string get_title() const { return string(title); }
+};
+
+// Index of every ROM under a directory, so a ROM can be found by title or content hash
+// without scanning the library again.
+//
+// The index file is made to be mapped and used in place:
+//   "GBRI" version:u32 count:u32 strings_size:u32
+//   count RomRecords sorted by content hash
+//   count u32 record numbers sorted by title
+//   the string table of paths
+class RomLibrary
+{
+	public:
+
+		static const uint32_t VERSION = 1;
+
+		// Scans a directory tree in parallel and writes the index, returns the number of
+		// ROMs indexed or -1 when the index couldn't be written
+		static int build(string directory, string index_location);
+
+		bool open(string index_location);
+
+		size_t size() { return count; }
+		const RomRecord& record(size_t id) { return records[id]; }
+		string get_path(const RomRecord &rom);
+
+		const RomRecord* find_hash(uint64_t hash);
+
+		// Exact title match, case insensitive. Several dumps can share a title
+		vector<const RomRecord*> find_title(string title);
+
+		// A content hash as 16 hex digits, otherwise a title
+		vector<const RomRecord*> find(string title_or_hash);
+
+	private:
+
+		struct IndexHeader
+		{
+			char magic[4];
+			uint32_t version;
+			uint32_t count;
+			uint32_t strings_size;
+		};
+
+		MappedFile file;
+		size_t count = 0;
+		const RomRecord* records = nullptr;
+		const uint32_t* title_order = nullptr;
+		const char* strings = nullptr;
+		size_t strings_size = 0;
+
+		static bool read_rom(string location, RomRecord &rom);
+};
@@ -0,0 +1,468 @@
+#include "self_tests.h"
+#include "validator.h"
+#include "compression.h"
+#include "movie.h"
+#include "trajectory.h"
+
+#include <cstring>
+
+int SelfTests::run()
+{
+	struct Check
+	{
+		const char* name;
+		Result (SelfTests::*run)();
+	};
+
+	const Check checks[] = {
+		{ "interrupt inside a block", &SelfTests::interrupt_inside_block },
+		{ "LY and DIV through a GDMA stall", &SelfTests::gdma_stall },
+		{ "LY and DIV through a speed switch", &SelfTests::speed_switch_stall },
+		{ "boot register A tells DMG and CGB apart", &SelfTests::boot_registers },
+		{ "PackBits round trip", &SelfTests::packbits_round_trip },
+		{ "movie seek and verify", &SelfTests::movie_seek },
+		{ "trajectory write and read back", &SelfTests::trajectory_round_trip },
+	};
+
+	int failed = 0;
+
+	for (const Check &check : checks)
+	{
+		Result result = (this->*check.run)();
+
+		if (!result.passed)
+			failed++;
+
+		cout << (result.passed ? "PASS " : "FAIL ") << check.name;
+		if (!result.reason.empty())
+			cout << ": " << result.reason;
+		cout << endl;
+	}
+
+	int total = sizeof(checks) / sizeof(checks[0]);
+	cout << (total - failed) << "/" << total << " self tests passed" << endl;
+	return failed;
+}
+
+vector<Byte> SelfTests::build_rom(const vector<Byte> &program, bool cgb,
+	const vector<pair<Address, vector<Byte>>> &handlers)
+{
+	vector<Byte> rom(0x8000, 0);
+
+	// NOP; JP $0150
+	const Byte entry[] = { 0x00, 0xC3, 0x50, 0x01 };
+	copy(entry, entry + 4, rom.begin() + 0x100);
+
+	const char title[] = "SELFTEST";
+	copy(title, title + 8, rom.begin() + 0x134);
+	rom[0x143] = cgb ? 0x80 : 0x00;
+
+	copy(program.begin(), program.end(), rom.begin() + 0x150);
+
+	for (const auto &handler : handlers)
+		copy(handler.second.begin(), handler.second.end(), rom.begin() + handler.first);
+
+	return rom;
+}
+
+// The timer interrupts every 1024 cycles while the loop runs INC instructions whose flags
+// are dead until the next one or ADD overwrites them. The handler pushes AF and pops it
+// back, so any stale flag taken into it shows up on the stack and in F after the return.
+SelfTests::Result SelfTests::interrupt_inside_block()
+{
+	const vector<Byte> program = {
+		0x31, 0xFE, 0xFF, // LD SP, $FFFE
+		0x3E, 0xFF,       // LD A, $FF
+		0xE0, 0x06,       // LDH (TMA), A - overflow on every tick
+		0xE0, 0x05,       // LDH (TIMA), A
+		0x3E, 0x04,       // LD A, $04
+		0xE0, 0x07,       // LDH (TAC), A - 4096 Hz
+		0x3E, 0x04,       // LD A, $04
+		0xE0, 0xFF,       // LDH (IE), A - timer
+		0xFB,             // EI
+		0x04,             // loop: INC B
+		0x0C,             // INC C
+		0x14,             // INC D
+		0x1C,             // INC E
+		0x04,             // INC B
+		0x0C,             // INC C
+		0x80,             // ADD A, B
+		0x18, 0xF7,       // JR loop
+	};
+
+	const vector<Byte> timer_handler = {
+		0xF5, // PUSH AF
+		0xF1, // POP AF
+		0xD9, // RETI
+	};
+
+	Validator validator(build_rom(program, false, { { 0x50, timer_handler } }));
+	validator.interval = 1000;
+
+	Result result;
+	result.passed = validator.run(100000);
+
+	if (!result.passed)
+		result.reason = "optimized core diverged from the reference interpreter";
+
+	return result;
+}
+
+SelfTests::Result SelfTests::stall_timing(const vector<Byte> &setup, const vector<Byte> &stall, int stall_cycles)
+{
+	const vector<Byte> read_before = {
+		0xF0, 0x44, // LDH A, (LY)
+		0x47,       // LD B, A
+		0xF0, 0x04, // LDH A, (DIV)
+		0x4F,       // LD C, A
+	};
+
+	const vector<Byte> read_after = {
+		0xF0, 0x44, // LDH A, (LY)
+		0x57,       // LD D, A
+		0xF0, 0x04, // LDH A, (DIV)
+		0x5F,       // LD E, A
+		0x18, 0xFE, // JR -2
+	};
+
+	vector<Byte> program = setup;
+	program.insert(program.end(), read_before.begin(), read_before.end());
+	program.insert(program.end(), stall.begin(), stall.end());
+	program.insert(program.end(), read_after.begin(), read_after.end());
+
+	Address done = (Address) (0x150 + program.size() - 2);
+
+	Emulator emulator(true);
+	emulator.load_rom(build_rom(program, true), false);
+
+	Result result;
+
+	for (int i = 0; i < 10000 && emulator.cpu.reg_PC != done; i++)
+		emulator.step();
+
+	if (emulator.cpu.reg_PC != done)
+	{
+		result.reason = "program never finished";
+		return result;
+	}
+
+	CPU &cpu = emulator.cpu;
+	int lines = (cpu.reg_D - cpu.reg_B + 154) % 154;
+	int divider = (Byte) (cpu.reg_E - cpu.reg_C);
+
+	// DIV counts CPU cycles, twice as many per clock cycle in double speed
+	double expected_lines = stall_cycles / 456.0;
+	double expected_divider = (stall_cycles << emulator.memory.speed_shift) / 256.0;
+
+	// The reads are a few instructions apart on top of the stall
+	result.passed = abs(lines - expected_lines) <= 1.5 && abs(divider - expected_divider) <= 1.5;
+
+	if (!result.passed)
+	{
+		stringstream reason;
+		reason << "LY moved " << lines << " lines, expected " << expected_lines
+			<< ", DIV moved " << divider << ", expected " << expected_divider;
+		result.reason = reason.str();
+	}
+
+	return result;
+}
+
+// A general purpose VRAM DMA of 128 blocks holds the CPU for 4096 clock cycles, nine
+// scanlines and sixteen DIV ticks
+SelfTests::Result SelfTests::gdma_stall()
+{
+	const vector<Byte> setup = {
+		0x3E, 0xC0, // LD A, $C0
+		0xE0, 0x51, // LDH (HDMA1), A - source $C000
+		0xAF,       // XOR A
+		0xE0, 0x52, // LDH (HDMA2), A
+		0x3E, 0x80, // LD A, $80
+		0xE0, 0x53, // LDH (HDMA3), A - destination $8000
+		0xAF,       // XOR A
+		0xE0, 0x54, // LDH (HDMA4), A
+	};
+
+	const vector<Byte> stall = {
+		0x3E, 0x7F, // LD A, $7F
+		0xE0, 0x55, // LDH (HDMA5), A - 128 blocks right away
+	};
+
+	return stall_timing(setup, stall, 128 * 32);
+}
+
+// Switching to double speed holds the CPU for 8200 clock cycles, eighteen scanlines and
+// sixty four DIV ticks at the new speed
+SelfTests::Result SelfTests::speed_switch_stall()
+{
+	const vector<Byte> setup = {
+		0x3E, 0x01, // LD A, $01
+		0xE0, 0x4D, // LDH (KEY1), A - prepare the switch
+	};
+
+	const vector<Byte> stall = {
+		0x10, 0x00, // STOP
+	};
+
+	return stall_timing(setup, stall, 8200);
+}
+
+// Games check A at $0100 for $11 to know they run on a CGB, and take their DMG path
+// or show a lockout screen otherwise
+SelfTests::Result SelfTests::boot_registers()
+{
+	const vector<Byte> program = {
+		0xEA, 0x00, 0xC0, // LD ($C000), A
+		0x18, 0xFE,       // JR -2
+	};
+
+	Result result;
+	result.passed = true;
+
+	for (bool cgb : { false, true })
+	{
+		Emulator emulator(true);
+		emulator.load_rom(build_rom(program, cgb), false);
+
+		for (int i = 0; i < 10; i++)
+			emulator.step();
+
+		Byte expected = cgb ? 0x11 : 0x01;
+		Byte found = emulator.memory.read(0xC000);
+
+		if (found != expected)
+		{
+			stringstream reason;
+			reason << (cgb ? "CGB" : "DMG") << " cartridge started with A=$" << hex << (int) found
+				<< ", expected $" << (int) expected;
+			result.reason = reason.str();
+			result.passed = false;
+		}
+	}
+
+	return result;
+}
+
+// Runs at and past the 128 byte limit, literals at the limit and at the very end, and
+// nothing at all
+SelfTests::Result SelfTests::packbits_round_trip()
+{
+	vector<vector<Byte>> inputs;
+
+	inputs.push_back({});
+	inputs.push_back(vector<Byte>(128, 0x00));
+	inputs.push_back(vector<Byte>(129, 0xFF));
+	inputs.push_back(vector<Byte>(300, 0x55));
+
+	vector<Byte> trailing_literal(200, 0x00);
+	trailing_literal.push_back(0x42);
+	inputs.push_back(trailing_literal);
+
+	vector<Byte> literals;
+	for (int i = 0; i < 260; i++)
+		literals.push_back((Byte) i);
+	inputs.push_back(literals);
+
+	// Pairs are too short to be a run
+	inputs.push_back({ 1, 1, 2, 2, 3, 3, 3, 4 });
+
+	Result result;
+	result.passed = true;
+
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		const vector<Byte> &input = inputs[i];
+		vector<Byte> packed = compress(input.data(), input.size());
+
+		if (decompress(packed.data(), packed.size()) != input)
+		{
+			result.reason = "input " + to_string(i) + " of " + to_string(input.size()) + " bytes changed";
+			result.passed = false;
+			break;
+		}
+	}
+
+	// A full run is a control byte and the value
+	if (result.passed && compress(inputs[1].data(), inputs[1].size()).size() != 2)
+	{
+		result.reason = "a run of 128 bytes took more than two bytes";
+		result.passed = false;
+	}
+
+	return result;
+}
+
+// Records a movie whose state depends on every frame's input, then seeks back into it
+// from the end and from power on, and replays its keyframe segments
+SelfTests::Result SelfTests::movie_seek()
+{
+	const vector<Byte> program = {
+		0x3E, 0x20,       // loop: LD A, $20
+		0xE0, 0x00,       // LDH (P1), A - select the arrows
+		0xF0, 0x00,       // LDH A, (P1)
+		0x80,             // ADD A, B
+		0x47,             // LD B, A
+		0xEA, 0x00, 0xC0, // LD ($C000), A
+		0x18, 0xF3,       // JR loop
+	};
+
+	vector<Byte> rom = build_rom(program);
+
+	const size_t frames = 150, target = 100;
+
+	Movie movie;
+	movie.keyframe_interval = 30;
+
+	Emulator recorder(true);
+	recorder.load_rom(rom, false);
+
+	uint64_t target_hash = 0;
+
+	for (size_t frame = 0; frame < frames; frame++)
+	{
+		if (frame == target)
+			target_hash = recorder.state_hash();
+
+		recorder.set_joypad((Byte) (INPUT_RIGHT << (frame * 7 % 4)));
+		movie.run_frame(recorder);
+	}
+
+	Result result;
+
+	movie.seek(recorder, target);
+	if (movie.current_frame != target || recorder.state_hash() != target_hash)
+	{
+		result.reason = "seeking back from the end missed the frame";
+		return result;
+	}
+
+	Emulator player(true);
+	player.load_rom(rom, false);
+	movie.current_frame = 0;
+
+	movie.seek(player, target);
+	if (player.state_hash() != target_hash)
+	{
+		result.reason = "seeking from power on missed the frame";
+		return result;
+	}
+
+	int failed = movie.verify(rom);
+	result.passed = (failed == 0);
+
+	if (!result.passed)
+		result.reason = to_string(failed) + " keyframe segments desynced";
+
+	return result;
+}
+
+// Rows spread over several chunks come back as they were recorded, and a chunk that
+// no longer decompresses to its rows is reported instead of copied out
+SelfTests::Result SelfTests::trajectory_round_trip()
+{
+	const vector<Byte> program = {
+		0x04,             // loop: INC B
+		0x78,             // LD A, B
+		0xEA, 0x00, 0xC0, // LD ($C000), A
+		0x18, 0xF9,       // JR loop
+	};
+
+	const string location = "self_test_trajectory.gbtj";
+	const int frames = 300;
+
+	Emulator emulator(true);
+	emulator.load_rom(build_rom(program), false);
+
+	vector<Byte> observation(Display::observation_size(Observation::GRAY_80x72));
+	emulator.display.observation = Observation::GRAY_80x72;
+	emulator.display.observation_buffer = observation.data();
+
+	// An odd number of bytes ahead of the features leaves them unaligned in the ring
+	RamFeatures features;
+	features.add_range(0xC000, 3);
+	features.add_u16(0xC000);
+
+	TrajectoryWriter writer(emulator, &features);
+	writer.chunk_rows = 64;
+	writer.ring_rows = 16;
+	writer.reward = [](Emulator &emulator) { return (float) emulator.memory.read(0xC000); };
+
+	Result result;
+
+	if (!writer.open(location))
+	{
+		result.reason = "couldn't create " + location;
+		return result;
+	}
+
+	vector<Byte> inputs, observations;
+	vector<float> feature_rows, rewards;
+
+	for (int frame = 0; frame < frames; frame++)
+	{
+		Byte input = (Byte) (frame * 37);
+		emulator.set_joypad(input);
+		emulator.run_frame();
+		writer.record(input);
+
+		vector<float> row(features.size());
+		features.gather(emulator.memory, row.data());
+
+		inputs.push_back(input);
+		observations.insert(observations.end(), observation.begin(), observation.end());
+		feature_rows.insert(feature_rows.end(), row.begin(), row.end());
+		rewards.push_back((float) emulator.memory.read(0xC000));
+	}
+
+	writer.close();
+
+	TrajectoryReader reader;
+	const uint64_t first = 50, count = 200;
+
+	vector<Byte> read_inputs(count);
+	vector<Byte> read_observations(count * observation.size());
+	vector<float> read_features(count * features.size());
+	vector<float> read_rewards(count);
+
+	bool read = reader.open(location) && reader.rows() == frames
+		&& reader.read("input", first, count, read_inputs.data())
+		&& reader.read("observation", first, count, read_observations.data())
+		&& reader.read("features", first, count, (Byte*) read_features.data())
+		&& reader.read("reward", first, count, (Byte*) read_rewards.data());
+
+	if (!read)
+		result.reason = "rows couldn't be read back";
+	else if (!equal(read_inputs.begin(), read_inputs.end(), inputs.begin() + first)
+		|| !equal(read_observations.begin(), read_observations.end(), observations.begin() + first * observation.size())
+		|| !equal(read_features.begin(), read_features.end(), feature_rows.begin() + first * features.size())
+		|| !equal(read_rewards.begin(), read_rewards.end(), rewards.begin() + first))
+		result.reason = "rows read back differ from the recorded ones";
+	else
+		result.passed = true;
+
+	// The first chunk written is the frame column's, right after the header. A run
+	// control byte in place of its first literal one throws its length off
+	if (result.passed)
+	{
+		fstream file(location, ios::in | ios::out | ios::binary);
+		streamoff header = 16;
+		for (const char* name : { "frame", "input", "observation", "features", "reward" })
+			header += 8 + (streamoff) strlen(name);
+
+		file.seekp(header);
+		file.put((char) 0x81);
+		file.close();
+
+		vector<uint64_t> frame_numbers(count);
+		TrajectoryReader damaged;
+
+		if (damaged.open(location) && damaged.read("frame", 0, count, (Byte*) frame_numbers.data()))
+		{
+			result.reason = "a damaged chunk was read without an error";
+			result.passed = false;
+		}
+	}
+
+	remove(location.c_str());
+	return result;
+}
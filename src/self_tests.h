@@ -0,0 +1,39 @@
+#pragma once
+
+#include "emulator.h"
+
+// Checks of behaviour that no test ROM collection pins down for this emulator, like the
+// block decoder's flag elision, the hardware timing around DMA and movie keyframes. Most
+// checks assemble a small program into a ROM image in memory and run it headless.
+class SelfTests
+{
+	public:
+
+		// Returns the number of checks that didn't pass
+		int run();
+
+	private:
+
+		struct Result
+		{
+			bool passed = false;
+			string reason;
+		};
+
+		// 32kB ROM image that starts the program at $0150. Handlers are placed at their
+		// interrupt vectors
+		static vector<Byte> build_rom(const vector<Byte> &program, bool cgb = false,
+			const vector<pair<Address, vector<Byte>>> &handlers = {});
+
+		// Runs setup, reads LY and DIV, runs the stalling instructions and reads them
+		// again. Both have to move on by the stall's length in clock cycles
+		Result stall_timing(const vector<Byte> &setup, const vector<Byte> &stall, int stall_cycles);
+
+		Result interrupt_inside_block();
+		Result gdma_stall();
+		Result speed_switch_stall();
+		Result boot_registers();
+		Result packbits_round_trip();
+		Result movie_seek();
+		Result trajectory_round_trip();
+};
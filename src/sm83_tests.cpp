@@ -0,0 +1,224 @@
+#include "sm83_tests.h"
+#include "parallel.h"
+
+#include <filesystem>
+#include <sstream>
+
+int ConformanceRunner::run(string directory)
+{
+	vector<string> files;
+
+	for (const auto &entry : filesystem::directory_iterator(directory))
+	{
+		if (entry.path().extension() == ".json")
+			files.push_back(entry.path().string());
+	}
+
+	sort(files.begin(), files.end());
+
+	vector<FileResult> results(files.size());
+
+	// One opcode file per job
+	parallel_for(files.size(), [&](size_t id)
+	{
+		results[id] = run_file(files[id]);
+	});
+
+	int total = 0, failed = 0;
+
+	for (const FileResult &result : results)
+	{
+		total += result.tests;
+
+		int failures = result.state_failures + result.cycle_failures + result.write_failures;
+		if (failures == 0)
+			continue;
+
+		failed += failures;
+		cout << result.name << ": " << result.state_failures << " state, "
+			<< result.cycle_failures << " timing, " << result.write_failures << " bus write failures of "
+			<< result.tests << " (first: " << result.first_failure << ")" << endl;
+	}
+
+	cout << files.size() << " opcode files, " << total << " tests, " << failed << " failures" << endl;
+	return failed;
+}
+
+ConformanceRunner::FileResult ConformanceRunner::run_file(string location)
+{
+	FileResult result;
+	result.name = filesystem::path(location).stem().string();
+
+	JsonValue tests;
+
+	try
+	{
+		tests = JsonValue::parse_file(location);
+	}
+	catch (const exception &error)
+	{
+		result.state_failures = 1;
+		result.first_failure = error.what();
+		return result;
+	}
+
+	// Opcode byte under test, "cb xx" files all start with the prefix
+	Opcode opcode = (result.name.compare(0, 2, "cb") == 0) ? 0xCB : (Opcode) stoi(result.name, nullptr, 16);
+
+	// Some test sets model the fetch/execute overlap, PC then points one past the opcode
+	int at_pc = 0, before_pc = 0;
+
+	for (size_t i = 0; i < tests.size(); i++)
+	{
+		const JsonValue &initial = tests[i]["initial"];
+		int pc = initial["pc"].as_int();
+		const JsonValue &ram = initial["ram"];
+
+		for (size_t j = 0; j < ram.size(); j++)
+		{
+			if (ram[j][0].as_int() == pc && ram[j][1].as_int() == opcode)
+				at_pc++;
+			if (ram[j][0].as_int() == ((pc - 1) & 0xFFFF) && ram[j][1].as_int() == opcode)
+				before_pc++;
+		}
+	}
+
+	int pc_offset = (before_pc > at_pc) ? 1 : 0;
+
+	Memory memory;
+	memory.load_flat();
+
+	CPU cpu;
+	cpu.init(&memory);
+
+	// Bus writes are taken from a write log, decoded after each test
+	uint64_t clock = 0;
+	vector<WriteLog::Write> writes;
+
+	WriteLog log;
+	log.clock = &clock;
+	log.on_frame = [&](uint64_t, uint64_t base_cycle, const vector<Byte> &data)
+	{
+		writes = WriteLog::decode(data.data(), data.size(), base_cycle);
+	};
+	memory.write_log = &log;
+
+	for (size_t i = 0; i < tests.size(); i++)
+	{
+		const JsonValue &test = tests[i];
+		result.tests++;
+
+		load_state(cpu, memory, test["initial"], pc_offset);
+		log.reset();
+		cpu.parse_opcode(memory.read(cpu.reg_PC));
+		log.end_frame(0);
+
+		string failure = compare_state(cpu, memory, test["final"], pc_offset);
+
+		if (!failure.empty())
+		{
+			result.state_failures++;
+		}
+		else if (check_cycles && cpu.num_cycles != (int) test["cycles"].size() * 4)
+		{
+			failure = "took " + to_string(cpu.num_cycles / 4) + " m-cycles, expected " + to_string(test["cycles"].size());
+			result.cycle_failures++;
+		}
+		else if (check_writes)
+		{
+			// Bus entries look like [address, value, "r-m"], writes have 'w' as the second pin
+			vector<pair<Address, Byte>> expected;
+			const JsonValue &cycles = test["cycles"];
+
+			for (size_t j = 0; j < cycles.size(); j++)
+			{
+				const JsonValue &cycle = cycles[j];
+				if (cycle.size() >= 3 && cycle[2].text.size() >= 2 && cycle[2].text[1] == 'w')
+					expected.push_back(make_pair((Address) cycle[0].as_int(), (Byte) cycle[1].as_int()));
+			}
+
+			vector<pair<Address, Byte>> actual;
+			for (const WriteLog::Write &write : writes)
+				actual.push_back(make_pair(write.address, write.value));
+
+			if (expected != actual)
+			{
+				failure = "bus writes differ";
+				result.write_failures++;
+			}
+		}
+
+		if (!failure.empty() && result.first_failure.empty())
+			result.first_failure = test["name"].text + " " + failure;
+
+		// Clear only what the test touched
+		const JsonValue &ram = test["initial"]["ram"];
+		for (size_t j = 0; j < ram.size(); j++)
+			memory.write(ram[j][0].as_int(), 0);
+		for (const WriteLog::Write &write : writes)
+			memory.write(write.address, 0);
+	}
+
+	return result;
+}
+
+void ConformanceRunner::load_state(CPU &cpu, Memory &memory, const JsonValue &state, int pc_offset)
+{
+	cpu.reg_A = state["a"].as_int();
+	cpu.reg_B = state["b"].as_int();
+	cpu.reg_C = state["c"].as_int();
+	cpu.reg_D = state["d"].as_int();
+	cpu.reg_E = state["e"].as_int();
+	cpu.reg_F = state["f"].as_int();
+	cpu.reg_H = state["h"].as_int();
+	cpu.reg_L = state["l"].as_int();
+	cpu.reg_SP = state["sp"].as_int();
+	cpu.reg_PC = state["pc"].as_int() - pc_offset;
+	cpu.interrupt_master_enable = state["ime"].as_int() != 0;
+	cpu.halted = false;
+	cpu.num_cycles = 0;
+
+	const JsonValue &ram = state["ram"];
+	for (size_t i = 0; i < ram.size(); i++)
+		memory.write(ram[i][0].as_int(), ram[i][1].as_int());
+
+	if (!state["ie"].is_null())
+		memory.write(0xFFFF, state["ie"].as_int());
+}
+
+// Returns a description of the first mismatch, or nothing when the state matches
+string ConformanceRunner::compare_state(CPU &cpu, Memory &memory, const JsonValue &state, int pc_offset)
+{
+	stringstream failure;
+	failure << hex;
+
+	auto check = [&](const char *name, int actual, int expected)
+	{
+		if (actual != expected && failure.tellp() == 0)
+			failure << name << " " << actual << " expected " << expected;
+	};
+
+	check("A", cpu.reg_A, state["a"].as_int());
+	check("B", cpu.reg_B, state["b"].as_int());
+	check("C", cpu.reg_C, state["c"].as_int());
+	check("D", cpu.reg_D, state["d"].as_int());
+	check("E", cpu.reg_E, state["e"].as_int());
+	check("F", cpu.reg_F, state["f"].as_int());
+	check("H", cpu.reg_H, state["h"].as_int());
+	check("L", cpu.reg_L, state["l"].as_int());
+	check("SP", cpu.reg_SP, state["sp"].as_int());
+	check("PC", cpu.reg_PC, (state["pc"].as_int() - pc_offset) & 0xFFFF);
+
+	if (!state["ime"].is_null())
+		check("IME", cpu.interrupt_master_enable, state["ime"].as_int());
+
+	const JsonValue &ram = state["ram"];
+	for (size_t i = 0; i < ram.size(); i++)
+	{
+		int location = ram[i][0].as_int();
+		if (memory.read(location) != ram[i][1].as_int() && failure.tellp() == 0)
+			failure << "(" << location << ") " << (int) memory.read(location) << " expected " << ram[i][1].as_int();
+	}
+
+	return failure.str();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "cpu.h"
+#include "json.h"
+#include "write_log.h"
+
+// Runs the per-opcode single step test files (one JSON file per opcode, e.g. "3e.json",
+// "cb 1f.json") against CPU::parse_opcode, sharded over all cores
+class ConformanceRunner
+{
+	public:
+
+		bool check_cycles = true; // compare instruction timing
+		bool check_writes = true; // compare the sequence of bus writes
+
+		// Returns the number of failing tests
+		int run(string directory);
+
+	private:
+
+		struct FileResult
+		{
+			string name;
+			int tests = 0;
+			int state_failures = 0;
+			int cycle_failures = 0;
+			int write_failures = 0;
+			string first_failure;
+		};
+
+		FileResult run_file(string location);
+		void load_state(CPU &cpu, Memory &memory, const JsonValue &state, int pc_offset);
+		string compare_state(CPU &cpu, Memory &memory, const JsonValue &state, int pc_offset);
+};
@@ -0,0 +1,199 @@
+#include "test_roms.h"
+#include "parallel.h"
+
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+
+static string stop_reason_text(StopReason reason)
+{
+	switch (reason)
+	{
+		case StopReason::ILLEGAL_OPCODE: return "locked up on an illegal opcode";
+		case StopReason::HALT_FOREVER:   return "halted with no interrupts enabled";
+		case StopReason::RST_38_SPIN:    return "stuck in RST 38";
+		case StopReason::FROZEN:         return "frozen";
+		default:                         return "";
+	}
+}
+
+int TestRomRunner::run(string directory)
+{
+	vector<string> roms;
+
+	for (const auto &entry : filesystem::recursive_directory_iterator(directory))
+	{
+		string extension = entry.path().extension().string();
+		if (extension == ".gb" || extension == ".gbc")
+			roms.push_back(entry.path().string());
+	}
+
+	sort(roms.begin(), roms.end());
+
+	vector<RomResult> results(roms.size());
+
+	parallel_for(roms.size(), [&](size_t id)
+	{
+		results[id] = run_rom(roms[id]);
+	});
+
+	int failed = 0;
+
+	for (const RomResult &result : results)
+	{
+		if (!result.passed)
+			failed++;
+
+		cout << (result.passed ? "PASS " : "FAIL ") << result.name
+			<< fixed << setprecision(2) << " (" << result.runtime << "s, "
+			<< result.emulated_seconds << "s emulated)";
+
+		if (!result.reason.empty())
+			cout << ": " << result.reason;
+
+		cout << endl;
+	}
+
+	cout << (roms.size() - failed) << "/" << roms.size() << " test ROMs passed" << endl;
+	return failed;
+}
+
+TestRomRunner::RomResult TestRomRunner::run_rom(string location)
+{
+	RomResult result;
+	result.name = filesystem::path(location).filename().string();
+
+	if (filesystem::file_size(location) < 0x150)
+	{
+		result.reason = "not a ROM";
+		return result;
+	}
+
+	auto start = chrono::steady_clock::now();
+
+	Emulator emulator(true);
+	emulator.load_rom(location, false);
+	emulator.freeze_seconds = freeze_seconds;
+
+	bool finished = false;
+	int frames = 0;
+	int max_frames = (int) (timeout * 60);
+
+	while (!finished && frames < max_frames)
+	{
+		emulator.run_frame();
+		frames++;
+
+		finished = check_serial(emulator, result)
+			|| check_memory_signature(emulator, result)
+			|| check_mooneye_signature(emulator, result);
+
+		if (!finished && emulator.stop_reason != StopReason::NONE)
+		{
+			result.reason = stop_reason_text(emulator.stop_reason);
+			finished = true;
+		}
+	}
+
+	if (!finished)
+		result.reason = "timed out";
+
+	result.emulated_seconds = frames / 60.0;
+	result.runtime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	return result;
+}
+
+// Blargg tests print their name, progress and finally "Passed" or "Failed"
+bool TestRomRunner::check_serial(Emulator &emulator, RomResult &result)
+{
+	vector<Byte> &output = emulator.serial_output;
+
+	// Mooneye tests send the fibonacci numbers on success and 0x42 on failure
+	static const Byte fibonacci[] = { 3, 5, 8, 13, 21, 34 };
+	if (output.size() >= 6 && equal(fibonacci, fibonacci + 6, output.end() - 6))
+	{
+		result.passed = true;
+		return true;
+	}
+	if (output.size() >= 6 && all_of(output.end() - 6, output.end(), [](Byte b) { return b == 0x42; }))
+	{
+		result.reason = "failure signature over serial";
+		return true;
+	}
+
+	string text(output.begin(), output.end());
+
+	if (text.find("Passed") != string::npos)
+	{
+		result.passed = true;
+		return true;
+	}
+	// Wait for the rest of the line, it holds the failing test number
+	size_t failed = text.find("Failed");
+	if (failed != string::npos && text.find('\n', failed) != string::npos)
+	{
+		replace(text.begin(), text.end(), '\n', ' ');
+		result.reason = text;
+		return true;
+	}
+
+	return false;
+}
+
+// Blargg tests also keep a result block in cartridge RAM:
+// $A001 - $A003 = DE B0 61, $A000 = result code (0x80 while running), $A004 = text
+bool TestRomRunner::check_memory_signature(Emulator &emulator, RomResult &result)
+{
+	Memory &memory = emulator.memory;
+
+	if (memory.read(0xA001) != 0xDE || memory.read(0xA002) != 0xB0 || memory.read(0xA003) != 0x61)
+		return false;
+
+	Byte status = memory.read(0xA000);
+	if (status == 0x80)
+		return false;
+
+	result.passed = (status == 0);
+
+	if (!result.passed)
+	{
+		result.reason = "result code " + to_string(status) + ": ";
+		for (Address location = 0xA004; location < 0xBFFF; location++)
+		{
+			Byte character = memory.read(location);
+			if (character == 0)
+				break;
+			result.reason.push_back((character == '\n') ? ' ' : character);
+		}
+	}
+
+	return true;
+}
+
+// Mooneye tests finish in an infinite JR loop with B C D E H L holding
+// 3 5 8 13 21 34 on success, or 0x42 in every register on failure
+bool TestRomRunner::check_mooneye_signature(Emulator &emulator, RomResult &result)
+{
+	CPU &cpu = emulator.cpu;
+	Memory &memory = emulator.memory;
+
+	if (memory.fetch(cpu.reg_PC) != 0x18 || memory.fetch(cpu.reg_PC + 1) != 0xFE)
+		return false;
+
+	if (cpu.reg_B == 3 && cpu.reg_C == 5 && cpu.reg_D == 8
+		&& cpu.reg_E == 13 && cpu.reg_H == 21 && cpu.reg_L == 34)
+	{
+		result.passed = true;
+		return true;
+	}
+
+	if (cpu.reg_B == 0x42 && cpu.reg_C == 0x42 && cpu.reg_D == 0x42
+		&& cpu.reg_E == 0x42 && cpu.reg_H == 0x42 && cpu.reg_L == 0x42)
+	{
+		result.reason = "failure signature in registers";
+		return true;
+	}
+
+	return false;
+}
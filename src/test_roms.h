@@ -0,0 +1,36 @@
+#pragma once
+
+#include "emulator.h"
+
+// Runs a directory of test ROMs headless and in parallel. A ROM passes or fails based on
+// the text it prints over the serial port (Blargg), the result block Blargg tests keep in
+// cartridge RAM at $A000, or the register signature Mooneye tests finish with.
+class TestRomRunner
+{
+	public:
+
+		// Emulated seconds before a ROM that hasn't reported anything is failed
+		double timeout = 120;
+
+		// Emulated seconds without a new frame or joypad polling before a ROM is failed as frozen
+		float freeze_seconds = 30;
+
+		// Returns the number of ROMs that didn't pass
+		int run(string directory);
+
+	private:
+
+		struct RomResult
+		{
+			string name;
+			bool passed = false;
+			string reason;
+			double runtime = 0;          // wall clock seconds
+			double emulated_seconds = 0;
+		};
+
+		RomResult run_rom(string location);
+		bool check_serial(Emulator &emulator, RomResult &result);
+		bool check_memory_signature(Emulator &emulator, RomResult &result);
+		bool check_mooneye_signature(Emulator &emulator, RomResult &result);
+};
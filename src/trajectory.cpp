@@ -0,0 +1,314 @@
+#include "trajectory.h"
+#include "compression.h"
+
+#include <chrono>
+#include <cstring>
+
+static const char TRAJECTORY_MAGIC[4] = { 'G', 'B', 'T', 'J' };
+static const uint32_t TRAJECTORY_VERSION = 1;
+
+// Size of the trailer at the very end of the file
+static const int TRAJECTORY_TRAILER_SIZE = 8 + 4 + 8 + 4;
+
+TrajectoryWriter::TrajectoryWriter(Emulator &_emulator, RamFeatures* _features)
+	: emulator(_emulator), features(_features), rows_written(0), rows_read(0), closing(false)
+{
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+	close();
+}
+
+bool TrajectoryWriter::open(string location)
+{
+	file.open(location, ios::binary | ios::trunc);
+
+	if (!file.is_open())
+		return false;
+
+	Display &display = emulator.display;
+	observation_size = display.observation_buffer ? Display::observation_size(display.observation) : 0;
+
+	columns.clear();
+	columns.push_back({ "frame", (int) sizeof(uint64_t), {}, 0, 0 });
+	columns.push_back({ "input", (int) sizeof(Byte), {}, 0, 0 });
+	if (observation_size > 0)
+		columns.push_back({ "observation", observation_size, {}, 0, 0 });
+	if (features)
+		columns.push_back({ "features", (int) (features->size() * sizeof(float)), {}, 0, 0 });
+	columns.push_back({ "reward", (int) sizeof(float), {}, 0, 0 });
+
+	row_size = 0;
+	for (Column &column : columns)
+		row_size += column.row_size;
+
+	uint32_t chunk_row_count = chunk_rows;
+	uint32_t column_count = (uint32_t) columns.size();
+
+	file.write(TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+	file.write((char*)&TRAJECTORY_VERSION, sizeof(TRAJECTORY_VERSION));
+	file.write((char*)&chunk_row_count, sizeof(chunk_row_count));
+	file.write((char*)&column_count, sizeof(column_count));
+
+	for (Column &column : columns)
+	{
+		uint32_t name_length = (uint32_t) column.name.size();
+		uint32_t size = column.row_size;
+		file.write((char*)&name_length, sizeof(name_length));
+		file.write(column.name.data(), name_length);
+		file.write((char*)&size, sizeof(size));
+	}
+
+	index.clear();
+	total_rows = 0;
+
+	feature_row.assign(features ? features->size() : 0, 0);
+	ring.assign(ring_rows * row_size, 0);
+	rows_written = 0;
+	rows_read = 0;
+	closing = false;
+
+	writer = thread(&TrajectoryWriter::write_rows, this);
+	return true;
+}
+
+void TrajectoryWriter::record(Byte input)
+{
+	if (!writer.joinable())
+		return;
+
+	// Ring is full, wait for the writer thread to catch up
+	while (rows_written - rows_read >= ring_rows)
+		this_thread::yield();
+
+	Byte* row = &ring[(rows_written % ring_rows) * row_size];
+
+	uint64_t frame = emulator.frames_run;
+	memcpy(row, &frame, sizeof(frame));
+	row += sizeof(frame);
+
+	*row++ = input;
+
+	if (observation_size > 0)
+	{
+		memcpy(row, emulator.display.observation_buffer, observation_size);
+		row += observation_size;
+	}
+
+	if (features)
+	{
+		features->gather(emulator.memory, feature_row.data());
+		memcpy(row, feature_row.data(), feature_row.size() * sizeof(float));
+		row += feature_row.size() * sizeof(float);
+	}
+
+	float value = reward ? reward(emulator) : 0;
+	memcpy(row, &value, sizeof(value));
+
+	rows_written++;
+}
+
+void TrajectoryWriter::close()
+{
+	if (!writer.joinable())
+		return;
+
+	closing = true;
+	writer.join();
+
+	// Partial chunks
+	for (int i = 0; i < (int) columns.size(); i++)
+	{
+		if (columns[i].chunk_row_count > 0)
+			write_chunk(i);
+	}
+
+	uint64_t index_offset = (uint64_t) file.tellp();
+	uint32_t chunk_count = (uint32_t) index.size();
+
+	for (const TrajectoryChunk &chunk : index)
+	{
+		file.write((char*)&chunk.column, sizeof(chunk.column));
+		file.write((char*)&chunk.first_row, sizeof(chunk.first_row));
+		file.write((char*)&chunk.rows, sizeof(chunk.rows));
+		file.write((char*)&chunk.offset, sizeof(chunk.offset));
+		file.write((char*)&chunk.size, sizeof(chunk.size));
+	}
+
+	file.write((char*)&index_offset, sizeof(index_offset));
+	file.write((char*)&chunk_count, sizeof(chunk_count));
+	file.write((char*)&total_rows, sizeof(total_rows));
+	file.write(TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+
+	file.close();
+}
+
+// Writer thread, splits rows into their columns and writes out full chunks
+void TrajectoryWriter::write_rows()
+{
+	while (true)
+	{
+		if (rows_read == rows_written)
+		{
+			if (closing && rows_read == rows_written)
+				break;
+
+			this_thread::sleep_for(chrono::milliseconds(1));
+			continue;
+		}
+
+		const Byte* row = &ring[(rows_read % ring_rows) * row_size];
+
+		for (int i = 0; i < (int) columns.size(); i++)
+		{
+			Column &column = columns[i];
+
+			column.chunk.insert(column.chunk.end(), row, row + column.row_size);
+			row += column.row_size;
+
+			if (++column.chunk_row_count == chunk_rows)
+				write_chunk(i);
+		}
+
+		total_rows++;
+		rows_read++;
+	}
+}
+
+void TrajectoryWriter::write_chunk(int column_id)
+{
+	Column &column = columns[column_id];
+	vector<Byte> compressed = compress(column.chunk.data(), column.chunk.size());
+
+	TrajectoryChunk chunk;
+	chunk.column = column_id;
+	chunk.first_row = column.first_row;
+	chunk.rows = column.chunk_row_count;
+	chunk.offset = (uint64_t) file.tellp();
+	chunk.size = (uint32_t) compressed.size();
+
+	file.write((char*)compressed.data(), compressed.size());
+	index.push_back(chunk);
+
+	column.first_row += column.chunk_row_count;
+	column.chunk_row_count = 0;
+	column.chunk.clear();
+}
+
+bool TrajectoryReader::open(string location)
+{
+	file.open(location, ios::binary);
+
+	if (!file.is_open())
+		return false;
+
+	char magic[4];
+	uint32_t version, chunk_rows, column_count;
+
+	file.read(magic, sizeof(magic));
+	file.read((char*)&version, sizeof(version));
+	file.read((char*)&chunk_rows, sizeof(chunk_rows));
+	file.read((char*)&column_count, sizeof(column_count));
+
+	if (!file || !equal(magic, magic + 4, TRAJECTORY_MAGIC) || version != TRAJECTORY_VERSION)
+		return false;
+
+	names.clear();
+	row_sizes.clear();
+
+	for (uint32_t i = 0; i < column_count; i++)
+	{
+		uint32_t name_length, size;
+		file.read((char*)&name_length, sizeof(name_length));
+		string name(name_length, ' ');
+		file.read(&name[0], name_length);
+		file.read((char*)&size, sizeof(size));
+
+		names.push_back(name);
+		row_sizes.push_back(size);
+	}
+
+	// Trailer, then the index it points to
+	uint64_t index_offset;
+	uint32_t chunk_count;
+
+	file.seekg(-TRAJECTORY_TRAILER_SIZE, ios::end);
+	file.read((char*)&index_offset, sizeof(index_offset));
+	file.read((char*)&chunk_count, sizeof(chunk_count));
+	file.read((char*)&total_rows, sizeof(total_rows));
+	file.read(magic, sizeof(magic));
+
+	if (!file || !equal(magic, magic + 4, TRAJECTORY_MAGIC))
+		return false;
+
+	file.seekg(index_offset);
+	index.resize(chunk_count);
+
+	for (TrajectoryChunk &chunk : index)
+	{
+		file.read((char*)&chunk.column, sizeof(chunk.column));
+		file.read((char*)&chunk.first_row, sizeof(chunk.first_row));
+		file.read((char*)&chunk.rows, sizeof(chunk.rows));
+		file.read((char*)&chunk.offset, sizeof(chunk.offset));
+		file.read((char*)&chunk.size, sizeof(chunk.size));
+	}
+
+	return !file.fail();
+}
+
+uint64_t TrajectoryReader::rows()
+{
+	return total_rows;
+}
+
+int TrajectoryReader::row_size(string column)
+{
+	int id = find_column(column);
+	return (id < 0) ? 0 : row_sizes[id];
+}
+
+bool TrajectoryReader::read(string column, uint64_t first_row, size_t count, Byte* output)
+{
+	int id = find_column(column);
+
+	if (id < 0 || first_row + count > total_rows)
+		return false;
+
+	uint64_t last_row = first_row + count;
+	int size = row_sizes[id];
+
+	for (const TrajectoryChunk &chunk : index)
+	{
+		uint64_t chunk_end = chunk.first_row + chunk.rows;
+
+		if ((int) chunk.column != id || chunk_end <= first_row || chunk.first_row >= last_row)
+			continue;
+
+		vector<Byte> compressed(chunk.size);
+		file.seekg(chunk.offset);
+		file.read((char*)compressed.data(), chunk.size);
+		vector<Byte> rows = decompress(compressed.data(), compressed.size());
+
+		if (!file || rows.size() != (size_t) chunk.rows * size)
+			return false;
+
+		uint64_t start = max(first_row, chunk.first_row);
+		uint64_t end = min(last_row, chunk_end);
+
+		memcpy(output + (start - first_row) * size, &rows[(start - chunk.first_row) * size], (end - start) * size);
+	}
+
+	return !file.fail();
+}
+
+int TrajectoryReader::find_column(string column)
+{
+	for (int i = 0; i < (int) names.size(); i++)
+	{
+		if (names[i] == column)
+			return i;
+	}
+
+	return -1;
+}
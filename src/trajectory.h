@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include "emulator.h"
+#include "ram_features.h"
+
+// Records one row per frame into a columnar file: frame index, joypad input, the
+// display observation, RAM features and a reward. Each column is cut into chunks of
+// chunk_rows rows that are compressed on their own, and a footer index at the end of
+// the file gives the offset of every chunk so any range of frames can be read without
+// touching the rest.
+//
+// File layout, little endian:
+//   "GBTJ" version:u32 chunk_rows:u32 column_count:u32
+//   per column: name_length:u32 name row_size:u32
+//   compressed chunks
+//   per chunk: column:u32 first_row:u64 rows:u32 offset:u64 size:u32
+//   index_offset:u64 chunk_count:u32 total_rows:u64 "GBTJ"
+struct TrajectoryChunk
+{
+	uint32_t column;
+	uint64_t first_row;
+	uint32_t rows;
+	uint64_t offset;
+	uint32_t size;
+};
+
+class TrajectoryWriter
+{
+	public:
+
+		// Features are optional, and the observation column is only written when the
+		// display has an observation buffer set
+		TrajectoryWriter(Emulator &_emulator, RamFeatures* _features = nullptr);
+		~TrajectoryWriter();
+
+		function<float(Emulator&)> reward;
+
+		int chunk_rows = 1024;
+		size_t ring_rows = 256; // rows buffered for the writer thread
+
+		bool open(string location);
+
+		// Queue a row for the frame that was just run with the given INPUT_* buttons.
+		// Only waits if the writer thread has fallen ring_rows rows behind
+		void record(Byte input);
+
+		// Write the remaining rows and the index
+		void close();
+
+	private:
+
+		struct Column
+		{
+			string name;
+			int row_size;
+			vector<Byte> chunk;
+			int chunk_row_count = 0;
+			uint64_t first_row = 0;
+		};
+
+		Emulator &emulator;
+		RamFeatures* features;
+
+		ofstream file;
+		vector<Column> columns;
+		vector<TrajectoryChunk> index;
+		uint64_t total_rows = 0;
+		int row_size = 0;
+		int observation_size = 0;
+
+		// Features are gathered here first, rows in the ring aren't aligned for floats
+		vector<float> feature_row;
+
+		// Single producer, single consumer ring of whole rows
+		vector<Byte> ring;
+		atomic<size_t> rows_written;
+		atomic<size_t> rows_read;
+		atomic<bool> closing;
+		thread writer;
+
+		void write_rows();
+		void write_chunk(int column_id);
+};
+
+// Random access to a file written by TrajectoryWriter
+class TrajectoryReader
+{
+	public:
+
+		bool open(string location);
+
+		uint64_t rows();
+		int row_size(string column);
+
+		// Copy rows [first_row, first_row + count) of a column, returns false if out of range
+		// or a chunk doesn't decompress to its number of rows
+		bool read(string column, uint64_t first_row, size_t count, Byte* output);
+
+	private:
+
+		ifstream file;
+		vector<string> names;
+		vector<int> row_sizes;
+		vector<TrajectoryChunk> index;
+		uint64_t total_rows = 0;
+
+		int find_column(string column);
+};
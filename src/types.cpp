@@ -49,6 +49,20 @@ bool is_bit_set(Byte data, Byte bit)
 	return ((data >> bit) & 1) ? true : false;
 }
 
+// FNV-1a, chain calls by passing the previous result as the seed
+uint64_t hash_bytes(const Byte* data, size_t size, uint64_t seed)
+{
+	uint64_t hash = seed;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 0x100000001B3;
+	}
+
+	return hash;
+}
+
 /*
 	8-Bit Pair Helper Class
 */
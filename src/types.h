@@ -57,6 +57,7 @@ bool between(Byte target, int low, int high);
 Byte set_bit(Byte data, Byte bit);
 Byte clear_bit(Byte data, Byte bit);
 bool is_bit_set(Byte data, Byte bit);
+uint64_t hash_bytes(const Byte* data, size_t size, uint64_t seed = 0xCBF29CE484222325);
 
 // Register pair helper class
 class Pair
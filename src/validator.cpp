@@ -0,0 +1,114 @@
+#include "validator.h"
+
+Validator::Validator(string rom_location)
+	: optimized(true), reference(true)
+{
+	optimized.load_rom(rom_location);
+	reference.load_rom(rom_location);
+
+	reference.reference_core = true;
+}
+
+Validator::Validator(const vector<Byte> &rom)
+	: optimized(true), reference(true)
+{
+	optimized.load_rom(rom, false);
+	reference.load_rom(rom, false);
+
+	reference.reference_core = true;
+}
+
+// Returns false when the two cores diverged within the given number of instructions
+bool Validator::run(long instructions)
+{
+	while (instructions_run < instructions)
+	{
+		// Snapshot both machines so a failing interval can be replayed
+		stringstream optimized_state, reference_state;
+		optimized.save_state(optimized_state);
+		reference.save_state(reference_state);
+
+		int steps = (int) min((long) interval, instructions - instructions_run);
+
+		for (int i = 0; i < steps; i++)
+		{
+			optimized.step();
+			reference.step();
+		}
+
+		if (!states_match())
+		{
+			find_divergence(optimized_state, reference_state, steps);
+			return false;
+		}
+
+		instructions_run += steps;
+	}
+
+	cout << "No divergence in " << instructions_run << " instructions" << endl;
+	return true;
+}
+
+bool Validator::states_match()
+{
+	CPU &a = optimized.cpu;
+	CPU &b = reference.cpu;
+
+	// Flag updates deferred by the block decoder have to replay to the exact flags
+	a.resolve_flags();
+
+	return a.reg_A == b.reg_A && a.reg_B == b.reg_B && a.reg_C == b.reg_C
+		&& a.reg_D == b.reg_D && a.reg_E == b.reg_E && a.reg_H == b.reg_H
+		&& a.reg_L == b.reg_L && a.reg_SP == b.reg_SP && a.reg_PC == b.reg_PC
+		&& a.reg_F == b.reg_F
+		&& a.interrupt_master_enable == b.interrupt_master_enable
+		&& a.halted == b.halted
+		&& optimized.memory.hash() == reference.memory.hash();
+}
+
+// Replay the failing interval one instruction at a time
+void Validator::find_divergence(stringstream &optimized_state, stringstream &reference_state, int steps)
+{
+	optimized.load_state(optimized_state);
+	reference.load_state(reference_state);
+
+	for (int i = 0; i < steps; i++)
+	{
+		Address pc = reference.cpu.reg_PC;
+		Opcode code = reference.memory.read(pc);
+
+		optimized.step();
+		reference.step();
+
+		if (!states_match())
+		{
+			cout << "Divergence at instruction " << dec << (instructions_run + i)
+				<< ", PC " << hex << (int) pc << " opcode " << (int) code;
+			if (code == 0xCB)
+				cout << " " << (int) reference.memory.read(pc + 1);
+			cout << endl;
+
+			print_state("optimized", optimized);
+			print_state("reference", reference);
+			return;
+		}
+	}
+
+	cout << "Divergence in interval at instruction " << dec << instructions_run
+		<< " could not be reproduced" << endl;
+}
+
+void Validator::print_state(string name, Emulator &emulator)
+{
+	CPU &cpu = emulator.cpu;
+
+	cout << name << hex
+		<< ": A " << (int) cpu.reg_A << " F " << (int) cpu.reg_F
+		<< " B " << (int) cpu.reg_B << " C " << (int) cpu.reg_C
+		<< " D " << (int) cpu.reg_D << " E " << (int) cpu.reg_E
+		<< " H " << (int) cpu.reg_H << " L " << (int) cpu.reg_L
+		<< " SP " << (int) cpu.reg_SP << " PC " << (int) cpu.reg_PC
+		<< " IME " << cpu.interrupt_master_enable << " halted " << cpu.halted
+		<< " stale flags " << (int) cpu.stale_flags
+		<< " memory " << emulator.memory.hash() << dec << endl;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <sstream>
+#include "emulator.h"
+
+// Runs the block decoding CPU core in lockstep with the reference interpreter
+// (CPU::parse_opcode) and pinpoints the first instruction where they disagree
+class Validator
+{
+	public:
+
+		Validator(string rom_location);
+		Validator(const vector<Byte> &rom);
+
+		// Instructions executed between state comparisons
+		int interval = 10000;
+
+		bool run(long instructions);
+
+	private:
+
+		Emulator optimized;
+		Emulator reference;
+
+		long instructions_run = 0;
+
+		bool states_match();
+		void find_divergence(stringstream &optimized_state, stringstream &reference_state, int steps);
+		void print_state(string name, Emulator &emulator);
+};
@@ -0,0 +1,71 @@
+#include "write_log.h"
+
+bool WriteLog::open(string location)
+{
+	file.open(location, ios::binary | ios::trunc);
+	return file.is_open();
+}
+
+void WriteLog::end_frame(uint64_t frame)
+{
+	if (on_frame)
+		on_frame(frame, base_cycle, buffer);
+
+	if (file.is_open())
+	{
+		uint32_t size = (uint32_t) buffer.size();
+		file.write((char*)&frame, sizeof(frame));
+		file.write((char*)&base_cycle, sizeof(base_cycle));
+		file.write((char*)&count, sizeof(count));
+		file.write((char*)&size, sizeof(size));
+		file.write((char*)buffer.data(), size);
+	}
+
+	reset();
+}
+
+// Each frame is encoded on its own, starting from the cycle it began on
+void WriteLog::reset()
+{
+	buffer.clear();
+	count = 0;
+	base_cycle = clock ? *clock : 0;
+	last_cycle = base_cycle;
+	last_address = 0;
+}
+
+vector<WriteLog::Write> WriteLog::decode(const Byte* data, size_t size, uint64_t base_cycle)
+{
+	vector<Write> writes;
+	uint64_t cycle = base_cycle;
+	Address address = 0;
+	size_t i = 0;
+
+	auto get_varint = [&]()
+	{
+		uint64_t value = 0;
+		for (int shift = 0; i < size; shift += 7)
+		{
+			Byte part = data[i++];
+			value |= (uint64_t) (part & 0x7F) << shift;
+			if (!(part & 0x80))
+				break;
+		}
+		return value;
+	};
+
+	while (i < size)
+	{
+		cycle += get_varint();
+		uint64_t zigzag = get_varint();
+		Address delta = (zigzag & 1) ? ~(Address) (zigzag >> 1) : (Address) (zigzag >> 1);
+		address += delta;
+
+		if (i >= size)
+			break;
+
+		writes.push_back({ cycle, address, data[i++] });
+	}
+
+	return writes;
+}
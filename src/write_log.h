@@ -0,0 +1,70 @@
+#pragma once
+
+#include <functional>
+#include "types.h"
+
+// Log of every memory write made during a frame, handed to a callback and/or appended
+// to a file at the end of each frame. Entries are delta encoded against the previous
+// write as varints: cycle delta, zigzag address delta, then the value byte, so runs of
+// writes to neighbouring addresses take 3 bytes each.
+//
+// File frames: frame:u64 base_cycle:u64 count:u32 size:u32 followed by size bytes
+class WriteLog
+{
+	public:
+
+		struct Write
+		{
+			uint64_t cycle;
+			Address address;
+			Byte value;
+		};
+
+		// Clock the writes are stamped with, set by Emulator::attach_write_log()
+		const uint64_t* clock = nullptr;
+
+		// Called with each finished frame's encoded writes
+		function<void(uint64_t frame, uint64_t base_cycle, const vector<Byte> &data)> on_frame;
+
+		bool open(string location);
+
+		void log(Address address, Byte value)
+		{
+			uint64_t cycle = *clock;
+			Address delta = address - last_address;
+
+			put_varint(cycle - last_cycle);
+			put_varint((delta & 0x8000) ? ((~delta & 0xFFFF) << 1) | 1 : delta << 1);
+			buffer.push_back(value);
+
+			last_cycle = cycle;
+			last_address = address;
+			count++;
+		}
+
+		void end_frame(uint64_t frame);
+
+		// Drop anything logged so far and start a new frame at the current cycle
+		void reset();
+
+		static vector<Write> decode(const Byte* data, size_t size, uint64_t base_cycle);
+
+	private:
+
+		vector<Byte> buffer;
+		ofstream file;
+		uint64_t base_cycle = 0;
+		uint64_t last_cycle = 0;
+		Address last_address = 0;
+		uint32_t count = 0;
+
+		void put_varint(uint64_t value)
+		{
+			while (value >= 0x80)
+			{
+				buffer.push_back((Byte) (value | 0x80));
+				value >>= 7;
+			}
+			buffer.push_back((Byte) value);
+		}
+};